@@ -0,0 +1,377 @@
+/*
+bench-decode
+decode benchmark, runs the libmbus test frames through mbus_parse, mbus_frame_data_parse and
+the record to register mapping of emmbus2influx, the results are checked against the
+normalized xml files and the values returned by mbus_data_record_value
+
+usage: bench-decode [-n telegrams] [-v] directory|hex-file ...
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "log.h"
+#include "meterDef.h"
+#include "mbusread.h"
+
+// defined in emmbus2influx.cpp
+int mqttQOS;
+int mqttRetain;
+char * mqttprefix;
+int influxWriteMult;
+int modbusDebug;
+int serBaudrate = 2400;
+
+#define TELEGRAMS_DEF 1000000
+#define HEX_MAX       4096
+
+//*****************************************************************************
+// count allocations, glibc only
+
+#ifdef __GLIBC__
+static unsigned long numAllocs;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+	numAllocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	numAllocs++;
+	return __libc_calloc(nmemb,size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	numAllocs++;
+	return __libc_realloc(ptr,size);
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+}
+#define ALLOCS_COUNTED 1
+#else
+static unsigned long numAllocs;
+#define ALLOCS_COUNTED 0
+#endif
+
+//*****************************************************************************
+
+typedef struct benchFrame_t benchFrame_t;
+struct benchFrame_t {
+	char *name;
+	unsigned char data[HEX_MAX];
+	size_t len;
+	int isVariable;
+	int numRecords;
+	double *expected;		// value by record number for mapped records
+	meter_t *meter;			// one meter per frame, registers for all numeric records
+	benchFrame_t *next;
+};
+
+benchFrame_t *frames;
+int numFrames;
+int numXmlOk, numXmlDiffer, numXmlMissing;
+int numValuesOk, numValuesDiffer;
+
+
+static uint64_t getNs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static char * readFile(const char *fileName) {
+	FILE *f;
+	long size;
+	char *buf;
+
+	f = fopen(fileName,"r");
+	if (!f) return NULL;
+	fseek(f,0,SEEK_END);
+	size = ftell(f);
+	fseek(f,0,SEEK_SET);
+	buf = (char *)calloc(1,size+1);
+	if (fread(buf,1,size,f) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+
+// compare the normalized xml with <name>.norm.xml
+static void checkXml(benchFrame_t *fr, mbus_frame_data *frameData) {
+	char fileName[1024];
+	char *xml,*expected;
+	size_t len = strlen(fr->name);
+
+	snprintf(fileName,sizeof(fileName),"%.*s.norm.xml",(int)(len - 4),fr->name);
+	expected = readFile(fileName);
+	if (!expected) {
+		numXmlMissing++;
+		return;
+	}
+	xml = mbus_frame_data_xml_normalized(frameData);
+	if (xml && strcmp(xml,expected) == 0) numXmlOk++;
+	else {
+		EPRINTFN("%s: xml differs from %s",fr->name,fileName);
+		numXmlDiffer++;
+	}
+	free(xml);
+	free(expected);
+}
+
+
+// create a meter with a register for each record with a numeric value
+static void createMeter(benchFrame_t *fr, mbus_data_variable *data) {
+	meter_t *meter;
+	meterRegister_t *reg;
+	meterRegisterRead_t *rr,*rrLast = NULL;
+	mbus_data_record *record;
+	const char *value;
+	char *endptr;
+	char name[32];
+	double fvalue;
+	int i;
+
+	for (record = data->record; record; record = (mbus_data_record *)record->next) fr->numRecords++;
+
+	meter = (meter_t *)calloc(1,sizeof(meter_t));
+	meter->name = fr->name;
+	meter->maxRecordNumber = -1;
+	fr->expected = (double *)calloc(fr->numRecords + 1,sizeof(double));
+	for (record = data->record, i = 0; record; record = (mbus_data_record *)record->next, i++) {
+		value = mbus_data_record_value(record);
+		if (!value || !*value) continue;
+		fvalue = strtod(value,&endptr);
+		if (*endptr != 0) continue;
+		fr->expected[i] = fvalue;
+
+		reg = (meterRegister_t *)calloc(1,sizeof(meterRegister_t));
+		snprintf(name,sizeof(name),"r%d",i);
+		reg->name = strdup(name);
+		reg->recordNumber = i;
+		rr = (meterRegisterRead_t *)calloc(1,sizeof(meterRegisterRead_t));
+		rr->registerDef = reg;
+		if (rrLast) rrLast->next = rr;
+		else meter->registerRead = rr;
+		rrLast = rr;
+		meter->maxRecordNumber = i;
+	}
+	meter->recordRegister = (meterRegisterRead_t **)calloc(meter->maxRecordNumber + 2,sizeof(meterRegisterRead_t *));
+	for (rr = meter->registerRead; rr; rr = rr->next)
+		meter->recordRegister[rr->registerDef->recordNumber] = rr;
+	fr->meter = meter;
+}
+
+
+static void freeFrame(benchFrame_t *fr) {
+	meterRegisterRead_t *rr,*rrNext;
+
+	if (fr->meter) {
+		rr = fr->meter->registerRead;
+		while (rr) {
+			rrNext = rr->next;
+			free(rr->registerDef->name);
+			free(rr->registerDef);
+			free(rr);
+			rr = rrNext;
+		}
+		free(fr->meter->recordRegister);
+		free(fr->meter);
+	}
+	free(fr->expected);
+	free(fr->name);
+	free(fr);
+}
+
+
+// check the register values against the values returned by mbus_data_record_value
+static void checkValues(benchFrame_t *fr, mbus_data_variable *data) {
+	meterRegisterRead_t *rr;
+	int recordNumber = 0;
+	double expected;
+
+	for (rr = fr->meter->registerRead; rr; rr = rr->next) rr->fvalue = NAN;
+	process_mbus_data_variable(fr->meter,data,0,&recordNumber,NULL);
+	for (rr = fr->meter->registerRead; rr; rr = rr->next) {
+		expected = fr->expected[rr->registerDef->recordNumber];
+		// real values are formatted with 6 decimals by mbus_data_record_value
+		if (fabs(rr->fvalue - expected) <= 5e-7 + fabs(expected) * 1e-7) numValuesOk++;
+		else {
+			EPRINTFN("%s: record %d, expected %.15g, got %.15g",fr->name,rr->registerDef->recordNumber,expected,rr->fvalue);
+			numValuesDiffer++;
+		}
+	}
+}
+
+
+static void addFrame(const char *fileName) {
+	benchFrame_t *fr,*frLast;
+	char *hex;
+	mbus_frame frame;
+	mbus_frame_data frameData;
+
+	hex = readFile(fileName);
+	if (!hex) {
+		EPRINTFN("%s: unable to read",fileName);
+		return;
+	}
+	fr = (benchFrame_t *)calloc(1,sizeof(benchFrame_t));
+	fr->name = strdup(fileName);
+	fr->len = mbus_hex2bin(fr->data,sizeof(fr->data),(unsigned char *)hex,strlen(hex));
+	free(hex);
+
+	memset(&frame,0,sizeof(frame));
+	memset(&frameData,0,sizeof(frameData));
+	if (mbus_parse(&frame,fr->data,fr->len) != 0 || mbus_frame_data_parse(&frame,&frameData) != 0) {
+		VPRINTFN(1,"%s: unable to parse, skipped",fileName);
+		freeFrame(fr);
+		return;
+	}
+	checkXml(fr,&frameData);
+	if (frameData.type == MBUS_DATA_TYPE_VARIABLE) {
+		fr->isVariable = 1;
+		createMeter(fr,&frameData.data_var);
+		checkValues(fr,&frameData.data_var);
+		mbus_data_record_free(frameData.data_var.record);
+	}
+
+	if (frames) {
+		frLast = frames;
+		while (frLast->next) frLast = frLast->next;
+		frLast->next = fr;
+	} else frames = fr;
+	numFrames++;
+}
+
+
+static int compareNames(const void *a, const void *b) {
+	return strcmp(*(char * const *)a,*(char * const *)b);
+}
+
+
+static void addDirectory(const char *dirName) {
+	DIR *dir;
+	struct dirent *de;
+	char **names = NULL;
+	int numNames = 0;
+	int i;
+	size_t len;
+	char fileName[1024];
+
+	dir = opendir(dirName);
+	if (!dir) {
+		addFrame(dirName);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		len = strlen(de->d_name);
+		if (len < 5 || strcasecmp(de->d_name + len - 4,".hex") != 0) continue;
+		snprintf(fileName,sizeof(fileName),"%s/%s",dirName,de->d_name);
+		names = (char **)realloc(names,(numNames + 1) * sizeof(char *));
+		names[numNames++] = strdup(fileName);
+	}
+	closedir(dir);
+	qsort(names,numNames,sizeof(char *),compareNames);
+	for (i=0;i<numNames;i++) {
+		addFrame(names[i]);
+		free(names[i]);
+	}
+	free(names);
+}
+
+
+int main(int argc, char *argv[]) {
+	benchFrame_t *fr;
+	mbus_frame frame;
+	mbus_frame_data frameData;
+	unsigned long telegrams = TELEGRAMS_DEF;
+	unsigned long numTelegrams = 0, numRecords = 0, numMapped = 0, allocs;
+	uint64_t startNs, ns;
+	int recordNumber, numVariable = 0;
+	int opt;
+
+	while ((opt = getopt(argc,argv,"n:v")) != -1) {
+		switch (opt) {
+			case 'n':
+				telegrams = strtoul(optarg,NULL,10);
+				break;
+			case 'v':
+				log_verbosity++;
+				break;
+			default:
+				fprintf(stderr,"usage: %s [-n telegrams] [-v] directory|hex-file ...\n",argv[0]);
+				exit(1);
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr,"usage: %s [-n telegrams] [-v] directory|hex-file ...\n",argv[0]);
+		exit(1);
+	}
+
+	mbusRecord_init();
+	for (;optind < argc; optind++) addDirectory(argv[optind]);
+	if (!numFrames) {
+		EPRINTFN("no frames found");
+		exit(1);
+	}
+	for (fr = frames; fr; fr = fr->next) {
+		if (!fr->isVariable) continue;
+		numVariable++;
+		for (meterRegisterRead_t *rr = fr->meter->registerRead; rr; rr = rr->next) numMapped++;
+	}
+
+	memset(&frameData,0,sizeof(frameData));
+	allocs = numAllocs;
+	startNs = getNs();
+	while (numTelegrams < telegrams) {
+		for (fr = frames; fr && numTelegrams < telegrams; fr = fr->next) {
+			numTelegrams++;
+			if (mbus_parse(&frame,fr->data,fr->len) != 0) continue;
+			if (mbus_frame_data_parse(&frame,&frameData) != 0) continue;
+			if (frameData.type != MBUS_DATA_TYPE_VARIABLE) continue;
+			recordNumber = 0;
+			process_mbus_data_variable(fr->meter,&frameData.data_var,0,&recordNumber,NULL);
+			numRecords += recordNumber;
+			mbus_data_record_free(frameData.data_var.record);
+			frameData.data_var.record = NULL;
+		}
+	}
+	ns = getNs() - startNs;
+	allocs = numAllocs - allocs;
+
+	printf("frames:          %d (%d variable data, %lu records mapped to registers)\n",numFrames,numVariable,numMapped);
+	printf("telegrams:       %lu (%lu records) in %.3f s\n",numTelegrams,numRecords,ns / 1e9);
+	printf("ns/telegram:     %.0f\n",(double)ns / numTelegrams);
+	if (ALLOCS_COUNTED) printf("allocs/telegram: %.3f\n",(double)allocs / numTelegrams);
+	else printf("allocs/telegram: n/a\n");
+	printf("records/s:       %.0f\n",numRecords / (ns / 1e9));
+	printf("xml:             %d ok, %d differ, %d without .norm.xml\n",numXmlOk,numXmlDiffer,numXmlMissing);
+	printf("values:          %d ok, %d differ\n",numValuesOk,numValuesDiffer);
+
+	while (frames) {
+		fr = frames->next;
+		freeFrame(frames);
+		frames = fr;
+	}
+	mbusRecord_freePool();
+
+	return (numXmlDiffer || numValuesDiffer) ? 1 : 0;
+}
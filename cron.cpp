@@ -1,12 +1,43 @@
 #include "cron.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "log.h"
 #include "assert.h"
 
 
 cronDef_t *cronTab;
 
+// min-heap of due times, one entry per schedule member and one per pending retry
+typedef struct cronEntry_t cronEntry_t;
+struct cronEntry_t {
+	int64_t dueMs;			// ms, same time base as getCurrTime
+	unsigned int seq;		// keeps the order of meters due at the same time
+	meter_t * meter;
+	cronDef_t * cronDef;	// NULL for a retry
+	time_t queryTime;		// schedule time this entry is due for
+	int index;				// member index within the schedule, used for spreading
+	unsigned int retryId;	// for a retry, valid if equal to meter->retryId
+};
+
+cronEntry_t **cronHeap;
+int cronHeapNum;
+int cronHeapSize;
+unsigned int cronSeq;
+unsigned int cronRetryId;
+
+// meters queried in the current cycle
+meter_t **cronDue;
+int cronNumDue;
+int cronDueSize;
+
+// schedules with members queried in the current cycle
+cronDef_t **cronDueDef;
+int cronNumDueDef;
+int cronDueDefSize;
+
+const char * cronOverrunNames[] = { "none", "skip", "rotate", "defer" };
+
 cronDef_t * cron_find(const char * name) {
 	cronDef_t * cd = cronTab;
 
@@ -115,6 +146,41 @@ void cron_meter_add_byName(char * cronName, meter_t *meter) {
 
 
 
+// options after the cron expression, returns TK_EOL
+static int parseCronOptions (parser_t * pa, cronDef_t *cd) {
+	int tk;
+
+	tk = parserExpectOrEOL(pa,TK_COMMA);
+	while (tk == TK_COMMA) {
+		tk = parserGetToken(pa);
+		switch (tk) {
+			case TK_SPREAD:
+				tk = parserGetToken(pa);
+				if (tk == TK_EQUAL) {
+					cd->spread = parserExpectInteger(pa);
+					if (cd->spread < 1) parserError(pa,"spread: window in seconds >= 1 expected");
+					tk = parserExpectOrEOL(pa,TK_COMMA);
+				} else {
+					if (tk != TK_COMMA && tk != TK_EOL) parserError(pa,", or EOL expected");
+					cd->spread = CRON_SPREAD_INTERVAL;
+				}
+				break;
+			case TK_OVERRUN:
+				parserExpectEqual(pa,TK_IDENT);
+				if (strcasecmp(pa->strVal,"skip") == 0) cd->overrun = CRON_OVERRUN_SKIP;
+				else if (strcasecmp(pa->strVal,"rotate") == 0) cd->overrun = CRON_OVERRUN_ROTATE;
+				else if (strcasecmp(pa->strVal,"defer") == 0) cd->overrun = CRON_OVERRUN_DEFER;
+				else parserError(pa,"overrun: skip, rotate or defer expected");
+				tk = parserExpectOrEOL(pa,TK_COMMA);
+				break;
+			default:
+				parserError(pa,"parseCron: spread or overrun expected");
+		}
+	}
+	return tk;
+}
+
+
 int parseCron (parser_t * pa) {
 	int tk;
 	char *st;
@@ -127,11 +193,13 @@ int parseCron (parser_t * pa) {
 			case TK_DEFAULT:
 				parserExpectEqual(pa,TK_STRVAL);
 				cron_add(NULL,pa->strVal);
+				tk = parseCronOptions(pa,cron_find(NULL));
 				break;
             case TK_STRVAL:
 				st = strdup(pa->strVal);
 				parserExpectEqual(pa,TK_STRVAL);
 				cron_add(st,pa->strVal);
+				tk = parseCronOptions(pa,cron_find(st));
 				free(st);
 				break;
 			case TK_EOL:
@@ -153,16 +221,31 @@ int parseCron (parser_t * pa) {
 }
 
 
-time_t getCurrTime() {
+static time_t cron_localTime(time_t t) {
 #ifdef CRON_USE_LOCAL_TIME
-	time_t t = time(NULL);
     struct tm *lt = localtime(&t);
 	return mktime(lt);
 #else
-	return time(NULL);
+	return t;
 #endif
 }
 
+// not using time(NULL), it may use a coarse clock lagging behind clock_gettime
+time_t getCurrTime() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return cron_localTime(ts.tv_sec);
+}
+
+// current time in ms, same time base as getCurrTime
+int64_t getCurrTimeMs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return (int64_t)cron_localTime(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
 char * getFormattedTime(time_t t) {
 #if 0
 #ifdef CRON_USE_LOCAL_TIME
@@ -178,81 +261,357 @@ char * getFormattedTime(time_t t) {
 }
 
 
-int cron_queryMeters(int verboseMsg) {
-	meter_t * meter = meters;
-	cronMember_t * cm;
-	time_t currTime = getCurrTime();
-	char *timeStr;
+// calculate the next query time of a schedule and the interval
+static void cron_calcNext(cronDef_t *cd, time_t currTime) {
+	cd->nextQueryTime = cron_next(&cd->cronExpr, currTime);
+	cd->interval = cron_next(&cd->cronExpr, cd->nextQueryTime) - cd->nextQueryTime;
+}
 
-	while (meter) {
-		meter->meterHasBeenRead = 0;
-		meter->isDue = 0;
-		meter = meter->next;
+
+// set the due time of a schedule member, with spread the members get fixed offsets evenly
+// distributed across the interval or the window if smaller than the interval
+static void cron_setDueMs(cronEntry_t *ce) {
+	cronDef_t *cd = ce->cronDef;
+	int64_t window;
+
+	ce->dueMs = (int64_t)ce->queryTime * 1000;
+	if (! cd->spread || cd->numMembers < 2) return;
+	window = cd->interval;
+	if (cd->spread > 0 && cd->spread < window) window = cd->spread;
+	ce->dueMs += window * 1000 * ce->index / cd->numMembers;
+}
+
+
+static int cron_heap_less(cronEntry_t *a, cronEntry_t *b) {
+	if (a->dueMs != b->dueMs) return a->dueMs < b->dueMs;
+	return a->seq < b->seq;
+}
+
+
+static void cron_heap_push(cronEntry_t *ce) {
+	int i,parent;
+
+	if (cronHeapNum == cronHeapSize) {
+		cronHeapSize = cronHeapSize ? cronHeapSize * 2 : 64;
+		cronHeap = (cronEntry_t **)realloc(cronHeap,cronHeapSize * sizeof(cronEntry_t *));
+	}
+	i = cronHeapNum++;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (! cron_heap_less(ce,cronHeap[parent])) break;
+		cronHeap[i] = cronHeap[parent];
+		i = parent;
 	}
+	cronHeap[i] = ce;
+}
 
-	// mark all meters of all due schedules and calculate next query time
-	cronDef_t * cd = cronTab;
+
+static cronEntry_t * cron_heap_pop() {
+	cronEntry_t *top,*last;
+	int i,child;
+
+	if (cronHeapNum == 0) return NULL;
+	top = cronHeap[0];
+	last = cronHeap[--cronHeapNum];
+	i = 0;
+	while ((child = 2 * i + 1) < cronHeapNum) {
+		if (child + 1 < cronHeapNum && cron_heap_less(cronHeap[child + 1],cronHeap[child])) child++;
+		if (! cron_heap_less(cronHeap[child],last)) break;
+		cronHeap[i] = cronHeap[child];
+		i = child;
+	}
+	if (cronHeapNum) cronHeap[i] = last;
+	return top;
+}
+
+
+void cron_retry_add(meter_t *meter, int64_t dueMs) {
+	cronEntry_t * ce;
+
+	ce = (cronEntry_t *) calloc(1,sizeof(cronEntry_t));
+	ce->meter = meter;
+	ce->dueMs = dueMs;
+	ce->seq = cronSeq++;
+	if (++cronRetryId == 0) cronRetryId++;
+	ce->retryId = cronRetryId;
+	meter->retryId = cronRetryId;		// replaces a pending retry
+	cron_heap_push(ce);
+}
+
+
+void cron_freeAll() {
+	int i;
+
+	for (i=0;i<cronHeapNum;i++) free(cronHeap[i]);
+	free(cronHeap);
+	cronHeap = NULL;
+	cronHeapNum = cronHeapSize = 0;
+	free(cronDue);
+	cronDue = NULL;
+	cronNumDue = cronDueSize = 0;
+	free(cronDueDef);
+	cronDueDef = NULL;
+	cronNumDueDef = cronDueDefSize = 0;
+	cronDef_t *cd = cronTab;
 	while (cd) {
-		if (cron_is_due(currTime,cd)) {
-			if (cd->members) {
-				if (verbose) {
-					timeStr = getFormattedTime(time(NULL));
-					VPRINTF(1,"%s: Schedule \"%s\" is due: ",timeStr,cd->name ? cd->name : "default");
-					free(timeStr);
-				}
-				cd ->nextQueryTime = cron_next(&cd->cronExpr, currTime);
-				cm = cd->members;
-				int first=1;
-				while (cm) {
-					assert (cm->meter != NULL);
-					if (! cm->meter->disabled) {
-						VPRINTF(1,"%c%s",first?' ':',',cm->meter->name);
-						setMeterFvalueInfluxLast (cm->meter);
-						cm->meter->isDue++;
-					}
-					cm = cm->next;
-				}
-				if (verbose) {
-					timeStr = getFormattedTime(cd->nextQueryTime);
-					VPRINTF(1,", next query: %s\n",timeStr);
-					free(timeStr);
-				}
+		free(cd->memberArr);
+		cd->memberArr = NULL;
+		free(cd->include);
+		cd->include = NULL;
+		cd = cd->next;
+	}
+}
+
+
+int cron_msUntilDue() {
+	int64_t ms;
+
+	// skip cancelled retries
+	while (cronHeapNum && cronHeap[0]->cronDef == NULL && cronHeap[0]->retryId != cronHeap[0]->meter->retryId)
+		free(cron_heap_pop());
+	if (cronHeapNum == 0) return CRON_MS_MAX;
+	ms = cronHeap[0]->dueMs - getCurrTimeMs();
+	if (ms < 0) ms = 0;
+	if (ms > CRON_MS_MAX) ms = CRON_MS_MAX;
+	return ms;
+}
+
+
+static void cron_addDue(meter_t *meter) {
+	if (meter->isDue++) return;		// already due by another schedule
+	if (cronNumDue == cronDueSize) {
+		cronDueSize = cronDueSize ? cronDueSize * 2 : 64;
+		cronDue = (meter_t **)realloc(cronDue,cronDueSize * sizeof(meter_t *));
+	}
+	cronDue[cronNumDue++] = meter;
+}
+
+
+static void cron_addDueDef(cronDef_t *cd, int64_t dueMs) {
+	int i;
+
+	for (i=0;i<cronNumDueDef;i++)
+		if (cronDueDef[i] == cd) return;
+	cd->runDueMs = dueMs;		// entries are popped by due time, the first one is the earliest
+	if (cronNumDueDef == cronDueDefSize) {
+		cronDueDefSize = cronDueDefSize ? cronDueDefSize * 2 : 16;
+		cronDueDef = (cronDef_t **)realloc(cronDueDef,cronDueDefSize * sizeof(cronDef_t *));
+	}
+	cronDueDef[cronNumDueDef++] = cd;
+}
+
+
+// predicted duration of a run of the members in memberArr/include, buses are queried in
+// parallel, the members of a bus one after another
+static int cron_predict(cronDef_t *cd) {
+	meter_t *meter;
+	int64_t maxMs = 0;
+	int i;
+
+	for (i=0;i<cd->numMembers;i++)
+		if (cd->memberArr[i]->bus) cd->memberArr[i]->bus->planMs = 0;
+	for (i=0;i<cd->numMembers;i++) {
+		meter = cd->memberArr[i];
+		if (! meter->bus || meter->disabled) continue;
+		if (cd->include && ! cd->include[i]) continue;
+		meter->bus->planMs += meter->queryMsAvg;
+		if (meter->bus->planMs > maxMs) maxMs = meter->bus->planMs;
+	}
+	return maxMs;
+}
+
+
+typedef struct {
+	int index;
+	int priority;
+} cronPrio_t;
+
+static int cron_prio_cmp(const void *a, const void *b) {
+	const cronPrio_t *pa = (const cronPrio_t *)a;
+	const cronPrio_t *pb = (const cronPrio_t *)b;
+
+	if (pa->priority != pb->priority) return pb->priority - pa->priority;
+	return pa->index - pb->index;
+}
+
+
+// select the members fitting into the interval, in round robin (rotate) or priority (defer) order,
+// at least one member per bus is queried
+static void cron_selectMembers(cronDef_t *cd) {
+	cronPrio_t *order;
+	meter_t *meter;
+	int i,idx,firstExcluded = -1;
+
+	order = (cronPrio_t *)calloc(cd->numMembers,sizeof(cronPrio_t));
+	for (i=0;i<cd->numMembers;i++) {
+		meter = cd->memberArr[i];
+		if (cd->overrun == CRON_OVERRUN_ROTATE) {
+			order[i].index = (cd->rotateStart + i) % cd->numMembers;
+		} else {
+			order[i].index = i;
+			order[i].priority = meter->priority + meter->deferCount;	// deferred meters will move up
+		}
+		if (meter->bus) meter->bus->planMs = 0;
+	}
+	if (cd->overrun == CRON_OVERRUN_DEFER) qsort(order,cd->numMembers,sizeof(cronPrio_t),cron_prio_cmp);
+
+	for (i=0;i<cd->numMembers;i++) {
+		idx = order[i].index;
+		meter = cd->memberArr[idx];
+		cd->include[idx] = 1;
+		if (! meter->bus || meter->disabled) continue;
+		if (meter->bus->planMs == 0 || meter->bus->planMs + meter->queryMsAvg <= cd->runIntervalMs) {
+			meter->bus->planMs += meter->queryMsAvg;
+			meter->deferCount = 0;
+		} else {
+			cd->include[idx] = 0;
+			meter->deferCount++;
+			cd->numPostponed++;
+			if (firstExcluded < 0) firstExcluded = idx;
+			VPRINTFN(2,"%s: postponed by overrun policy of schedule \"%s\"",meter->name,cd->name ? cd->name : "default");
+		}
+	}
+	if (cd->overrun == CRON_OVERRUN_ROTATE && firstExcluded >= 0) cd->rotateStart = firstExcluded;
+	free(order);
+}
+
+
+// start of a new run of a schedule, check the previous run and predict the duration of this one
+static void cron_startRun(cronDef_t *cd, time_t queryTime) {
+	if (cd->numRuns && cd->actualMs > cd->runIntervalMs) cd->numOverruns++;
+	cd->numRuns++;
+	cd->runQueryTime = queryTime;
+	cd->runIntervalMs = (int64_t)cd->interval * 1000;
+	cd->actualMs = 0;
+	cd->runQueriedMs = 0;
+	if (cd->include) free(cd->include);
+	cd->include = NULL;
+
+	cd->predictedMs = cron_predict(cd);
+	if (cd->predictedMs > cd->runIntervalMs) {
+		if (! cd->overrunWarned)
+			LOGN(0,"Warning: predicted cycle time of schedule \"%s\" (%d ms) exceeds the interval (%lld ms)%s%s",
+				cd->name ? cd->name : "default",cd->predictedMs,(long long)cd->runIntervalMs,
+				cd->overrun ? ", overrun policy: " : "",cd->overrun ? cronOverrunNames[cd->overrun] : "");
+		cd->overrunWarned = 1;
+		if (cd->overrun == CRON_OVERRUN_ROTATE || cd->overrun == CRON_OVERRUN_DEFER) {
+			cd->include = (char *)calloc(cd->numMembers,sizeof(char));
+			cron_selectMembers(cd);
+			cd->predictedMs = cron_predict(cd);	// for the selected members
+		}
+	} else {
+		if (cd->overrunWarned)
+			LOGN(0,"predicted cycle time of schedule \"%s\" (%d ms) fits into the interval again",cd->name ? cd->name : "default",cd->predictedMs);
+		cd->overrunWarned = 0;
+	}
+	VPRINTFN(2,"Schedule \"%s\": predicted cycle time %d ms, interval %lld ms",cd->name ? cd->name : "default",cd->predictedMs,(long long)cd->runIntervalMs);
+}
+
+
+int cron_queryMeters(int verboseMsg) {
+	meter_t * meter;
+	cronEntry_t * ce;
+	cronDef_t * cd;
+	int64_t currTimeMs = getCurrTimeMs();
+	time_t currTime = currTimeMs / 1000;
+	char *timeStr;
+	int i;
+
+	// reset the meters of the last cycle
+	for (i=0;i<cronNumDue;i++) {
+		cronDue[i]->meterHasBeenRead = 0;
+		cronDue[i]->isDue = 0;
+	}
+	cronNumDue = 0;
+	cronNumDueDef = 0;
+
+	// mark all meters with due entries and calculate the next query time for their schedules
+	while (cronHeapNum && cronHeap[0]->dueMs <= currTimeMs) {
+		ce = cron_heap_pop();
+		meter = ce->meter;
+		cd = ce->cronDef;
+		if (cd == NULL) {
+			if (ce->retryId == meter->retryId) {		// not cancelled
+				meter->retryId = 0;
+				VPRINTFN(1,"%s: retrying query, %d retries left",meter->name,meter->retriesLeft);
+				cron_addDue(meter);
 			}
+			free(ce);
+			continue;
 		}
-		cd = cd->next;
+		if (cd->nextQueryTime <= ce->queryTime) {		// first member of this schedule due at that time
+			cron_startRun(cd,ce->queryTime);
+			cron_calcNext(cd,currTime);
+			if (verbose) {
+				timeStr = getFormattedTime(cd->nextQueryTime);
+				VPRINTFN(1,"Schedule \"%s\" is due, next query: %s",cd->name ? cd->name : "default",timeStr);
+				free(timeStr);
+			}
+		}
+		// overrun handling
+		int skip = 0;
+		if (cd->overrun == CRON_OVERRUN_SKIP && currTimeMs - ce->dueMs > CRON_LATE_MS) {
+			VPRINTFN(1,"%s: skipped, schedule \"%s\" is late by %lld ms",meter->name,cd->name ? cd->name : "default",(long long)(currTimeMs - ce->dueMs));
+			cd->numSkipped++;
+			skip++;
+		}
+		if (cd->include && cd->runQueryTime == ce->queryTime && ! cd->include[ce->index]) skip++;
+		int64_t dueMs = ce->dueMs;
+		ce->queryTime = cd->nextQueryTime;
+		cron_setDueMs(ce);
+		cron_heap_push(ce);
+		if (! meter->disabled && ! skip) {
+			cron_addDueDef(cd,dueMs);
+			VPRINTFN(2,"%s: due by schedule \"%s\"",meter->name,cd->name ? cd->name : "default");
+			if (! meter->isDue) setMeterFvalueInfluxLast (meter);
+			meter->retriesLeft = meter->retries;
+			meter->retryId = 0;			// a new schedule replaces a pending retry
+			cron_addDue(meter);
+		}
+	}
+	if (cronNumDue == 0) return 0;
+
+	// query all due meters, buses in parallel
+	int numMeters = queryDueMeters(verboseMsg,cronDue,cronNumDue);
+
+	// actual duration of the schedule runs, with spread a run consists of several calls, the time
+	// between the spread members is not counted. A call is measured from the due time of its first
+	// member (or the end of the previous call of the run if later) to include delays by other queries
+	currTimeMs = getCurrTimeMs();
+	for (i=0;i<cronNumDueDef;i++) {
+		cd = cronDueDef[i];
+		int64_t startMs = cd->runDueMs > cd->runQueriedMs ? cd->runDueMs : cd->runQueriedMs;
+		cd->actualMs += currTimeMs - startMs;
+		cd->runQueriedMs = currTimeMs;
+		cd->statsPending = 1;
+		VPRINTFN(2,"Schedule \"%s\": cycle time %d ms, predicted %d ms",cd->name ? cd->name : "default",cd->actualMs,cd->predictedMs);
 	}
 
-	// query all due meters
-	meter = meters;
-	int numMeters = 0;
-	while (meter) {
-		if (meter->isDue) {
-			int res = queryMeter(verboseMsg, meter);
-			if (! meter->isTCP) msleep(500);
-			if (res == 0) numMeters++;
+	// schedule a retry for failed meters, other meters will be queried in the meantime
+	for (i=0;i<cronNumDue;i++) {
+		meter = cronDue[i];
+		if (! meter->meterHasBeenRead) {
+			if (meter->retriesLeft > 0) {
+				meter->retriesLeft--;
+				cron_retry_add(meter,currTimeMs + meter->retryDelay);
+				VPRINTFN(1,"%s: query failed, retry in %d ms",meter->name,meter->retryDelay);
+			} else
+				if (meter->retries) EPRINTFN("%s: query failed after %d retries",meter->name,meter->retries);
 		}
-		meter = meter->next;
 	}
 
 #ifndef DISABLE_FORMULAS
 	// meter formulas
-	meter = meters;
-	while (meter) {
-		if (! meter->disabled)
-			if (meter->meterHasBeenRead) executeMeterFormulas(verboseMsg,meter);
-		meter = meter->next;
-	}
+	executeMeterFormulas(verboseMsg,cronDue,cronNumDue);
 #endif
 
     // handle influxWriteMult
-    meter = meters;
-	while (meter) {
-		if (! meter->disabled)
-			if (meter->meterHasBeenRead) {
-				setMeterFvalueInflux(meter);
-				executeInfluxWriteCalc(verboseMsg,meter);
-			}
-		meter = meter->next;
+	for (i=0;i<cronNumDue;i++) {
+		meter = cronDue[i];
+		if (meter->meterHasBeenRead) {
+			setMeterFvalueInflux(meter);
+			executeInfluxWriteCalc(verboseMsg,meter);
+		}
 	}
 
 	return numMeters;
@@ -265,7 +624,11 @@ void cron_showSchedules() {
 			"Name                Definition\n" \
 			"------------------------------------------------------------------------------\n");
 	while (cd) {
-		printf("%-20s%-30s\n%-20s",cd->name==NULL ? "default" : cd->name,cd->cronExpression,"");
+		printf("%-20s%-30s",cd->name==NULL ? "default" : cd->name,cd->cronExpression);
+		if (cd->spread == CRON_SPREAD_INTERVAL) printf(" spread");
+		else if (cd->spread) printf(" spread=%d",cd->spread);
+		if (cd->overrun) printf(" overrun=%s",cronOverrunNames[cd->overrun]);
+		printf("\n%-20s","");
 
 		cronMember_t * cm = cd->members;
 		int first = 1;
@@ -283,19 +646,62 @@ void cron_showSchedules() {
 	}
 }
 
+void cron_showStats() {
+	cronDef_t * cd = cronTab;
+	printf( "Schedule            Runs  Interval  Predicted     Actual Overruns  Skipped Postponed\n" \
+			"-----------------------------------------------------------------------------------\n");
+	while (cd) {
+		printf("%-20s%4u %7lldms %8dms %8dms %8u %8u %9u\n",cd->name==NULL ? "default" : cd->name,
+			cd->numRuns,(long long)cd->runIntervalMs,cd->predictedMs,cd->actualMs,cd->numOverruns,cd->numSkipped,cd->numPostponed);
+		cd = cd->next;
+	}
+}
+
+void cron_statsPublished() {
+	cronDef_t * cd = cronTab;
+	while (cd) {
+		cd->statsPending = 0;
+		cd = cd->next;
+	}
+}
+
 // set the default schedule for all meters where no schedule(s) are specified
 void cron_setDefault() {
 	meter_t * meter = meters;
 	time_t currTime = getCurrTime();
+	cronMember_t * cm;
+	cronEntry_t * ce;
+	int i;
 
 	while (meter) {
 		if (! meter->hasSchedule) cron_meter_add_byName(NULL,meter);
 		meter = meter->next;
 	}
-	// set next query time
+	// set next query time and add all schedule members to the heap
 	cronDef_t * cd = cronTab;
 	while (cd) {
-		cd->nextQueryTime = cron_next(&cd->cronExpr, currTime);
+		cron_calcNext(cd,currTime);
+		cd->numMembers = 0;
+		cm = cd->members;
+		while (cm) {
+			cd->numMembers++;
+			cm = cm->next;
+		}
+		cd->memberArr = (meter_t **) calloc(cd->numMembers,sizeof(meter_t *));
+		cm = cd->members;
+		i = 0;
+		while (cm) {
+			cd->memberArr[i] = cm->meter;
+			ce = (cronEntry_t *) calloc(1,sizeof(cronEntry_t));
+			ce->meter = cm->meter;
+			ce->cronDef = cd;
+			ce->queryTime = cd->nextQueryTime;
+			ce->index = i++;
+			ce->seq = cronSeq++;
+			cron_setDueMs(ce);
+			cron_heap_push(ce);
+			cm = cm->next;
+		}
 		cd = cd->next;
 	}
 }
@@ -47,9 +47,41 @@ struct cronDef_t {
 	char * cronExpression;
 	cron_expr cronExpr;
 	time_t nextQueryTime;
+	int spread;			// spread members across the interval (CRON_SPREAD_INTERVAL) or a window (seconds), 0 = off
+	time_t interval;	// seconds between nextQueryTime and the following query time
+	int numMembers;
+	meter_t **memberArr;	// members by index
+	int overrun;			// what to do if the members can not be queried within the interval, CRON_OVERRUN_*
+	char *include;			// members to be queried in the current run (rotate/defer)
+	time_t runQueryTime;	// query time of the current run
+	int64_t runIntervalMs;
+	int rotateStart;		// first member for the next run (rotate)
+	int predictedMs;		// predicted duration of a run
+	int actualMs;			// measured duration of the last run
+	int64_t runDueMs;		// due time of the first member queried in the current call
+	int64_t runQueriedMs;	// end of the last query of the current run
+	int overrunWarned;
+	int statsPending;		// run finished, predicted and actual duration not yet published
+	unsigned int numRuns;
+	unsigned int numOverruns;
+	unsigned int numSkipped;
+	unsigned int numPostponed;
 };
 
+#define CRON_SPREAD_INTERVAL -1
+
+// overrun policies
+#define CRON_OVERRUN_NONE   0	// only warn
+#define CRON_OVERRUN_SKIP   1	// skip members that are late because of the previous run
+#define CRON_OVERRUN_ROTATE 2	// query as many members as fit into the interval, round robin
+#define CRON_OVERRUN_DEFER  3	// query as many members as fit into the interval, by priority
+
+#define CRON_LATE_MS 1000		// a member is considered late with the skip policy
+
+extern cronDef_t *cronTab;
+
 time_t getCurrTime();
+int64_t getCurrTimeMs();
 void cron_add(const char *name, const char * cronExpression);		// name=NULL for default
 int  cron_is_due(time_t currTime, cronDef_t *cronDef);
 void cron_calc_next(cronDef_t *cronDef);
@@ -57,6 +89,8 @@ void cron_meter_add(cronDef_t *cronDef, meter_t *meter);
 void cron_meter_add_byName(char * cronName, meter_t *meter);
 int parseCron (parser_t * pa);
 void cron_showSchedules();
+void cron_showStats();
+void cron_statsPublished();		// the statistics of the finished runs have been sent to influx/mqtt
 
 /**
  * Query all meters that are due and calculate the next query time for all defined schedules
@@ -65,6 +99,19 @@ void cron_showSchedules();
  */
 int cron_queryMeters(int verboseMsg);
 
+#define CRON_MS_MAX 3600000	// max return value of cron_msUntilDue
+
+/**
+ * Get the time until the next schedule member or retry is due
+ * @return ms until due, 0 if already due
+ */
+int cron_msUntilDue();
+
+/**
+ * Free the schedule heap and pending retries
+ */
+void cron_freeAll();
+
 /**
  * Set the default schedule for all meters where no schedules are defined
  */
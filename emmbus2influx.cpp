@@ -70,6 +70,10 @@ mqtt_pubT *mClient;
 
 #define MQTT_PREFIX_DEF "ad/house/energy/"
 
+// the main loop sleeps until the next schedule is due but wakes up to service mqtt and grafana
+#define MQTT_YIELD_MS (mClient->conn_opts.keepAliveInterval * 1000 / 2)	// for mqtt ping
+#define WS_PING_MS    10000		// answer grafana websocket pings
+
 
 int doTry   = false;
 
@@ -80,6 +84,7 @@ int doTry   = false;
 #define INFLUX_DEFAULT_MEASUREMENT "energyMeter"
 #define INFLUX_DEFAULT_TAGNAME "Meter"
 char * influxMeasurement;
+char * schedMeasurement;		// measurement / mqtt topic for the schedule statistics, NULL if disabled
 char * influxTagName;
 int iVerifyPeer = 1;
 int influxWriteMult;    // write to influx only on x th query (>=2)
@@ -164,10 +169,13 @@ int parseArgs (int argc, char **argv) {
 		AP_OPT_STRVAL_CB    (0,0,"configfile"    ,NULL                   ,"config file name",&dummyCallback)
 		AP_OPT_STRVAL       (0,'d',"device"      ,&serDevice             ,"specify serial device name")
 		AP_OPT_INTVAL       (1,0 ,"baud"         ,&serBaudrate           ,"baudrate")
+		AP_OPT_INTVAL       (1,0 ,"pollthreads"  ,&pollThreads           ,"max number of threads for querying serial ports and TCP gateways in parallel (0=one per port/gateway)")
+		AP_OPT_STRVAL       (1,0 ,"baudcache"    ,&baudCacheFile         ,"file to keep the baud rates meters have been switched to (switchbaud=) across restarts")
 
 		//AP_REQ_STRVAL_CB    (1,'a',"tags"        ,NULL                  ,"specify influxdb tags for each meter separated by ,", &parseTagCallback)
 		AP_OPT_STRVAL       (1,'m',"measurement"    ,&influxMeasurement    ,"Influxdb measurement")
 		AP_OPT_STRVAL       (1,'g',"tagname"        ,&influxTagName        ,"Influxdb tag name")
+		AP_OPT_STRVAL       (1,0  ,"schedmeasurement",&schedMeasurement    ,"Influxdb measurement and mqtt topic for schedule cycle times")
 		AP_OPT_STRVAL       (1,'s',"server"         ,&serverName           ,"influxdb server name or ip")
 		AP_OPT_INTVAL       (1,'o',"port"           ,&port                 ,"influxdb port")
 		AP_OPT_STRVAL       (1,'b',"db"             ,&dbName               ,"Influxdb v1 database name")
@@ -547,6 +555,52 @@ int influxAppendData (influx_client_t* c, meter_t *meter, uint64_t timestamp) {
 
 
 
+// predicted and actual duration of the schedule runs finished since the last call
+int influxAppendScheduleStats (influx_client_t* c, uint64_t timestamp) {
+	cronDef_t *cd = cronTab;
+	int numLines = 0;
+	int rc;
+
+	while (cd) {
+		if (cd->statsPending) {
+			rc = influxdb_format_line(c, INFLUX_MEAS(schedMeasurement), INFLUX_TAG("Schedule", cd->name ? cd->name : "default"),
+				INFLUX_F_INT("predictedMs", cd->predictedMs), INFLUX_F_INT("actualMs", cd->actualMs),
+				INFLUX_F_INT("overruns", cd->numOverruns), INFLUX_F_INT("skipped", cd->numSkipped), INFLUX_F_INT("postponed", cd->numPostponed),
+				INFLUX_TS(timestamp), INFLUX_END);
+			if (rc < 0) { EPRINTFN("influxdb_format_line failed, schedule statistics"); exit(1); }
+			numLines++;
+		}
+		cd = cd->next;
+	}
+	return numLines;
+}
+
+
+int mqttSendScheduleStats (int dryrun) {
+	cronDef_t *cd = cronTab;
+	char topic[256];
+	int rc = 0;
+
+	while (cd) {
+		if (cd->statsPending) {
+			snprintf(topic,sizeof(topic),"%s/%s",schedMeasurement,cd->name ? cd->name : "default");
+			if (dryrun) {
+				printf("%s = {\"predictedMs\":%d, \"actualMs\":%d, \"overruns\":%u, \"skipped\":%u, \"postponed\":%u}\n",
+					topic,cd->predictedMs,cd->actualMs,cd->numOverruns,cd->numSkipped,cd->numPostponed);
+			} else {
+				mClient->topicPrefix = mqttprefix;
+				rc = mqtt_pub_strF (mClient,topic, 0, mqttQOS,mqttRetain, "{\"predictedMs\":%d, \"actualMs\":%d, \"overruns\":%u, \"skipped\":%u, \"postponed\":%u}",
+					cd->predictedMs,cd->actualMs,cd->numOverruns,cd->numSkipped,cd->numPostponed);
+				if (rc != 0) LOGN(0,"mqtt publish failed with rc: %d",rc);
+				mClient->topicPrefix = NULL;
+			}
+		}
+		cd = cd->next;
+	}
+	return rc;
+}
+
+
 #define CHANNEL_MAX_LEN 140
 int grafanaAppendData (influx_client_t* c, meter_t *meter, uint64_t timestamp) {
 	meterRegisterRead_t *rr;
@@ -828,6 +882,9 @@ int main(int argc, char *argv[]) {
 
 	readMeterDefinitions (configFileName);
 	cron_setDefault();
+#ifndef DISABLE_FORMULAS
+	compileFormulas();
+#endif
 	if (verbose) cron_showSchedules();
 
 	if (dumpRegisters) {
@@ -932,9 +989,21 @@ int main(int argc, char *argv[]) {
 	}
 
 	int loopCount = 0;
+	uint64_t nextMqttYield = 0;
+	uint64_t nextWsPing = 0;
+	uint64_t now;
+	int64_t waitMs;
+	struct timespec ts;
 	while (!terminated) {
-		mqtt_pub_yield (mClient); // for mqtt ping, seeps for 100ms if no mqqt specified
-		if (gClient) influxdb_post_http(gClient);	// for websocket ping
+		now = getMonotonicMs();
+		if (mClient && now >= nextMqttYield) {
+			mqtt_pub_yield (mClient); // for mqtt ping
+			nextMqttYield = now + MQTT_YIELD_MS;
+		}
+		if (gClient && now >= nextWsPing) {
+			influxdb_post_http(gClient);	// for websocket ping
+			nextWsPing = now + WS_PING_MS;
+		}
 		clock_gettime(CLOCK_REALTIME,&timeStart);
 		if (isFirstQuery) rc = 1;
 		else rc = cron_queryMeters(verbose);
@@ -945,6 +1014,7 @@ int main(int argc, char *argv[]) {
 			queryTime = (double)(timeEnd.tv_sec + timeEnd.tv_nsec / NANO_PER_SEC)-(double)(timeStart.tv_sec + timeStart.tv_nsec / NANO_PER_SEC);
 			if (dryrun || verbose>0)
 				printf("Query %d took %4.2f seconds\n",loopCount,queryTime);
+			if (verbose > 2) { mbusBus_showStats(); cron_showStats(); }
 
 			if (iClient) {		// influx
 				influxdb_post_freeBuffer(iClient);
@@ -957,6 +1027,7 @@ int main(int argc, char *argv[]) {
 					}
 					meter = meter->next;
 				}
+				if (schedMeasurement) influxAppendScheduleStats (iClient, influxTimestamp);
 				if (dryrun) {
 					if (iClient->influxBuf) {
 						printf("\nDryrun: would send to influxdb:\n%s\n",iClient->influxBuf);
@@ -1013,8 +1084,10 @@ int main(int argc, char *argv[]) {
 					//else if (dryrun) printf(" %s: has not been read ",meter->name);
 					meter = meter->next;
 				}
+				if (schedMeasurement) mqttSendScheduleStats (dryrun);
 				if (dryrun) printf("\n");
 			}
+			cron_statsPublished();
 			if (isFirstQuery) isFirstQuery--;
 
 			if (dryrun) {
@@ -1022,6 +1095,20 @@ int main(int argc, char *argv[]) {
 				if (!dryrun) terminated++;
 			}
 		}
+
+		// sleep until the next schedule or retry is due or mqtt/grafana needs to be serviced
+		if (!terminated) {
+			waitMs = cron_msUntilDue();
+			now = getMonotonicMs();
+			if (mClient && (int64_t)(nextMqttYield - now) < waitMs) waitMs = nextMqttYield - now;
+			if (gClient && (int64_t)(nextWsPing - now) < waitMs) waitMs = nextWsPing - now;
+			if (waitMs > 0) {
+				VPRINTFN(5,"mainloop: sleeping %lld ms",(long long)waitMs);
+				ts.tv_sec = waitMs / 1000;
+				ts.tv_nsec = (waitMs % 1000) * 1000000;
+				nanosleep(&ts,NULL);	// will be interrupted by signals
+			}
+		}
 	}
 
 
@@ -1029,6 +1116,9 @@ int main(int argc, char *argv[]) {
 	freeFormulaParser();
 #endif // DISABLE_FORMULAS
 
+	if (verbose) { mbusBus_showStats(); cron_showStats(); }
+	cron_freeAll();
+	mbusBus_freeAll();
 	mbusTCP_freeAll();
 
 	if (mClient) mqtt_pub_free(mClient);
@@ -1038,6 +1128,7 @@ int main(int argc, char *argv[]) {
 	free(mqttprefix);
 
 	free(influxMeasurement);
+	free(schedMeasurement);
 	free(influxTagName);
 	free(serDevice);
 	freeMeters();
@@ -16,7 +16,7 @@
 #include "mbus-protocol.h"
 
 static int parse_debug = 0, debug = 0;
-static char error_str[512];
+static MBUS_THREAD_LOCAL char error_str[512];
 
 #define NITEMS(x) (sizeof(x)/sizeof(x[0]))
 
@@ -889,7 +889,7 @@ mbus_data_manufacturer_encode(unsigned char *m_data, unsigned char *m_code)
 const char *
 mbus_decode_manufacturer(unsigned char byte1, unsigned char byte2)
 {
-    static char m_str[4];
+    static MBUS_THREAD_LOCAL char m_str[4];
 
     int m_id;
 
@@ -909,7 +909,7 @@ mbus_decode_manufacturer(unsigned char byte1, unsigned char byte2)
 const char *
 mbus_data_product_name(mbus_data_variable_header *header)
 {
-    static char buff[128];
+    static MBUS_THREAD_LOCAL char buff[128];
     unsigned int manufacturer;
 
     memset(buff, 0, sizeof(buff));
@@ -1392,7 +1392,7 @@ mbus_data_product_name(mbus_data_variable_header *header)
 const char *
 mbus_data_fixed_medium(mbus_data_fixed *data)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
 
     if (data)
     {
@@ -1503,7 +1503,7 @@ mbus_data_fixed_medium(mbus_data_fixed *data)
 const char *
 mbus_data_fixed_unit(int medium_unit_byte)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
 
     switch (medium_unit_byte & 0x3F)
     {
@@ -1775,7 +1775,7 @@ mbus_data_fixed_unit(int medium_unit_byte)
 const char *
 mbus_data_variable_medium_lookup(unsigned char medium)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
 
     switch (medium)
     {
@@ -1971,7 +1971,7 @@ mbus_data_variable_medium_lookup(unsigned char medium)
 const char *
 mbus_unit_prefix(int exp)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
 
     switch (exp)
     {
@@ -2081,7 +2081,7 @@ mbus_dif_datalength_lookup(unsigned char dif)
 const char *
 mbus_vif_unit_lookup(unsigned char vif)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
     int n;
 
     switch (vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) // ignore the extension bit in this selection
@@ -2409,7 +2409,7 @@ mbus_vif_unit_lookup(unsigned char vif)
 const char *
 mbus_data_error_lookup(int error)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
 
     switch (error)
     {
@@ -2501,7 +2501,7 @@ mbus_unit_duration_pp(int pp)
 static const char *
 mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
     int n;
     const char * prefix = "";
     switch (vib->vife[0] & MBUS_DIB_VIF_WITHOUT_EXTENSION)
@@ -2752,7 +2752,7 @@ mbus_vib_unit_lookup_fb(mbus_value_information_block *vib)
 static const char *
 mbus_vib_unit_lookup_fd(mbus_value_information_block *vib)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
     int n;
 
     // ignore the extension bit in this selection
@@ -3071,7 +3071,7 @@ mbus_vib_unit_lookup_fd(mbus_value_information_block *vib)
 const char *
 mbus_vib_unit_lookup(mbus_value_information_block *vib)
 {
-    static char buff[256];
+    static MBUS_THREAD_LOCAL char buff[256];
     int n;
 
     if (vib == NULL)
@@ -3138,7 +3138,7 @@ mbus_vib_unit_lookup(mbus_value_information_block *vib)
 const char *
 mbus_data_record_decode(mbus_data_record *record)
 {
-    static char buff[768];
+    static MBUS_THREAD_LOCAL char buff[768];
     unsigned char vif, vife;
 
     if (record)
@@ -3367,7 +3367,7 @@ mbus_data_record_decode(mbus_data_record *record)
 const char *
 mbus_data_record_unit(mbus_data_record *record)
 {
-    static char buff[128];
+    static MBUS_THREAD_LOCAL char buff[128];
 
     if (record)
     {
@@ -3385,7 +3385,7 @@ mbus_data_record_unit(mbus_data_record *record)
 const char *
 mbus_data_record_value(mbus_data_record *record)
 {
-    static char buff[768];
+    static MBUS_THREAD_LOCAL char buff[768];
 
     if (record)
     {
@@ -3475,7 +3475,7 @@ int mbus_data_record_device(mbus_data_record *record)
 const char *
 mbus_data_record_function(mbus_data_record *record)
 {
-    static char buff[128];
+    static MBUS_THREAD_LOCAL char buff[128];
 
     if (record)
     {
@@ -3514,7 +3514,7 @@ mbus_data_record_function(mbus_data_record *record)
 const char *
 mbus_data_fixed_function(int status)
 {
-    static char buff[128];
+    static MBUS_THREAD_LOCAL char buff[128];
 
     snprintf(buff, sizeof(buff), "%s",
             (status & MBUS_DATA_FIXED_STATUS_DATE_MASK) == MBUS_DATA_FIXED_STATUS_DATE_STORED ?
@@ -3692,6 +3692,103 @@ mbus_parse(mbus_frame *frame, unsigned char *data, size_t data_size)
     return -1;
 }
 
+//------------------------------------------------------------------------------
+/// Discard all received data.
+//------------------------------------------------------------------------------
+void
+mbus_frame_stream_reset(mbus_frame_stream *stream)
+{
+    if (stream)
+    {
+        stream->len = 0;
+        stream->frame_size = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/// Parse the frame at the start of the receive buffer. Returns the number of
+/// bytes still missing (> 0), 0 if a frame has been parsed (use
+/// mbus_frame_stream_next to remove it from the buffer) or < 0 on errors
+/// (same as mbus_parse). The frame data is only parsed once it is complete.
+//------------------------------------------------------------------------------
+int
+mbus_frame_stream_parse(mbus_frame_stream *stream, mbus_frame *frame)
+{
+    if (stream == NULL || frame == NULL)
+    {
+        snprintf(error_str, sizeof(error_str), "Got null pointer to stream or frame.");
+        return -1;
+    }
+
+    if (stream->len == 0)
+    {
+        return 1;
+    }
+
+    if (stream->frame_size == 0)
+    {
+        switch (stream->data[0])
+        {
+            case MBUS_FRAME_ACK_START:
+                stream->frame_size = MBUS_FRAME_BASE_SIZE_ACK;
+                break;
+
+            case MBUS_FRAME_SHORT_START:
+                stream->frame_size = MBUS_FRAME_BASE_SIZE_SHORT;
+                break;
+
+            case MBUS_FRAME_LONG_START:
+                if (stream->len < 3)
+                {
+                    // need the length bytes
+                    return 3 - stream->len;
+                }
+
+                if (stream->data[1] < 3 || stream->data[1] != stream->data[2])
+                {
+                    snprintf(error_str, sizeof(error_str), "Invalid M-Bus frame length.");
+                    return -2;
+                }
+
+                stream->frame_size = MBUS_FRAME_FIXED_SIZE_LONG + stream->data[1];
+                break;
+
+            default:
+                snprintf(error_str, sizeof(error_str), "Invalid M-Bus frame start.");
+                return -4;
+        }
+    }
+
+    if (stream->len < stream->frame_size)
+    {
+        return stream->frame_size - stream->len;
+    }
+
+    return mbus_parse(frame, stream->data, stream->frame_size);
+}
+
+//------------------------------------------------------------------------------
+/// Remove the parsed frame from the receive buffer, keep the following bytes.
+//------------------------------------------------------------------------------
+void
+mbus_frame_stream_next(mbus_frame_stream *stream)
+{
+    if (stream == NULL)
+        return;
+
+    if (stream->frame_size > 0 && stream->frame_size < stream->len)
+    {
+        memmove(stream->data, stream->data + stream->frame_size, stream->len - stream->frame_size);
+        stream->len -= stream->frame_size;
+    }
+    else
+    {
+        stream->len = 0;
+    }
+
+    stream->frame_size = 0;
+}
+
 
 //------------------------------------------------------------------------------
 /// Parse the fixed-length data of a M-Bus frame
@@ -4568,7 +4665,7 @@ mbus_str_xml_encode(unsigned char *dst, const unsigned char *src, size_t max_len
 char *
 mbus_data_variable_header_xml(mbus_data_variable_header *header)
 {
-    static char buff[8192];
+    static MBUS_THREAD_LOCAL char buff[8192];
     char str_encoded[768];
     size_t len = 0;
 
@@ -4606,7 +4703,7 @@ mbus_data_variable_header_xml(mbus_data_variable_header *header)
 char *
 mbus_data_variable_record_xml(mbus_data_record *record, int record_cnt, int frame_cnt, mbus_data_variable_header *header)
 {
-    static char buff[8192];
+    static MBUS_THREAD_LOCAL char buff[8192];
     char str_encoded[768];
     size_t len = 0;
     struct tm * timeinfo;
@@ -5056,6 +5153,20 @@ mbus_frame_data_free(mbus_frame_data *data)
 
 
 
+//------------------------------------------------------------------------------
+// optional allocator for variable data records (e.g. a free list to avoid
+// heap allocations for each record), NULL to use malloc/free
+//------------------------------------------------------------------------------
+static mbus_data_record *(*record_alloc)(void) = NULL;
+static void (*record_release)(mbus_data_record *record) = NULL;
+
+void
+mbus_register_record_allocator(mbus_data_record *(*alloc)(void), void (*release)(mbus_data_record *record))
+{
+    record_alloc = alloc;
+    record_release = release;
+}
+
 //------------------------------------------------------------------------------
 /// Allocate and initialize a new variable data record
 //------------------------------------------------------------------------------
@@ -5064,7 +5175,12 @@ mbus_data_record_new()
 {
     mbus_data_record *record;
 
-    if ((record = (mbus_data_record *)malloc(sizeof(mbus_data_record))) == NULL)
+    if (record_alloc)
+        record = record_alloc();
+    else
+        record = (mbus_data_record *)malloc(sizeof(mbus_data_record));
+
+    if (record == NULL)
     {
         return NULL;
     }
@@ -5077,19 +5193,23 @@ mbus_data_record_new()
 
 //------------------------------------------------------------------------------
 /// free up memory associated with a data record and all the subsequent records
-/// in its list (apply recursively)
+/// in its list
 //------------------------------------------------------------------------------
 void
 mbus_data_record_free(mbus_data_record *record)
 {
-    if (record)
+    mbus_data_record *next;
+
+    while (record)
     {
-        mbus_data_record *next = record->next;
+        next = record->next;
 
-        free(record);
+        if (record_release)
+            record_release(record);
+        else
+            free(record);
 
-        if (next)
-            mbus_data_record_free(next);
+        record = next;
     }
 }
 
@@ -5125,7 +5245,7 @@ mbus_data_record_append(mbus_data_variable *data, mbus_data_record *record)
 char *
 mbus_frame_get_secondary_address(mbus_frame *frame)
 {
-    static char addr[32];
+    static MBUS_THREAD_LOCAL char addr[32];
     mbus_frame_data *data;
     unsigned long id;
 
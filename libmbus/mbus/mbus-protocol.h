@@ -26,6 +26,17 @@
 extern "C" {
 #endif
 
+//
+// The strings returned by the lookup and decode functions as well as the
+// error string are kept per thread, so telegrams can be decoded by several
+// threads at the same time.
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define MBUS_THREAD_LOCAL __thread
+#else
+#define MBUS_THREAD_LOCAL _Thread_local
+#endif
+
 //
 // Packet formats:
 //
@@ -268,6 +279,23 @@ typedef struct _mbus_frame_data {
 
 } mbus_frame_data;
 
+//
+// RECEIVE BUFFER FOR INCREMENTAL FRAME PARSING
+//
+// bytes are appended as they are received, the frame size is determined from
+// the frame header once, the frame is parsed when all of its bytes are there.
+// Bytes following a frame are kept for the next one.
+//
+#define MBUS_FRAME_STREAM_SIZE 512
+
+typedef struct _mbus_frame_stream {
+
+    unsigned char data[MBUS_FRAME_STREAM_SIZE];
+    size_t len;         // bytes in data
+    size_t frame_size;  // size of the frame at the start of data, 0 if not yet known
+
+} mbus_frame_stream;
+
 //
 // HEADER FOR SECONDARY ADDRESSING
 //
@@ -535,6 +563,7 @@ void mbus_dump_send_event(unsigned char src_type, const char *buff, size_t len);
 mbus_data_record *mbus_data_record_new();
 void              mbus_data_record_free(mbus_data_record *record);
 void              mbus_data_record_append(mbus_data_variable *data, mbus_data_record *record);
+void              mbus_register_record_allocator(mbus_data_record *(*alloc)(void), void (*release)(mbus_data_record *record));
 
 
 // XXX: Add application reset subcodes
@@ -556,6 +585,10 @@ int mbus_frame_calc_length  (mbus_frame *frame);
 //
 int mbus_parse(mbus_frame *frame, unsigned char *data, size_t data_size);
 
+void mbus_frame_stream_reset(mbus_frame_stream *stream);
+int  mbus_frame_stream_parse(mbus_frame_stream *stream, mbus_frame *frame);
+void mbus_frame_stream_next (mbus_frame_stream *stream);
+
 int mbus_data_fixed_parse   (mbus_frame *frame, mbus_data_fixed    *data);
 int mbus_data_variable_parse(mbus_frame *frame, mbus_data_variable *data);
 
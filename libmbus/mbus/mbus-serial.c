@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <sys/types.h>
 
@@ -27,6 +28,16 @@
 
 #define PACKET_BUFF_SIZE 2048
 
+//------------------------------------------------------------------------------
+/// Calculate the receive timeouts for a baud rate.
+//------------------------------------------------------------------------------
+static void
+mbus_serial_set_timeouts(mbus_serial_data *serial_data, long baudrate)
+{
+    serial_data->response_timeout = (MBUS_SERIAL_RESPONSE_BITS * 1000 + baudrate - 1) / baudrate + MBUS_SERIAL_RESPONSE_EXTRA_MS;
+    serial_data->byte_timeout = (MBUS_SERIAL_BYTE_BITS * 1000 + baudrate - 1) / baudrate + MBUS_SERIAL_BYTE_EXTRA_MS;
+}
+
 //------------------------------------------------------------------------------
 /// Set up a serial connection handle.
 //------------------------------------------------------------------------------
@@ -46,6 +57,7 @@ mbus_serial_connect(mbus_handle *handle)
 
     device = serial_data->device;
     term = &(serial_data->t);
+    mbus_frame_stream_reset(&(serial_data->stream));
     //
     // create the SERIAL connection
     //
@@ -61,12 +73,11 @@ mbus_serial_connect(mbus_handle *handle)
     term->c_cflag |= (CS8|CREAD|CLOCAL);
     term->c_cflag |= PARENB;
 
-    // No received data still OK
+    // read returns immediately with the data available, the timeouts are
+    // handled using poll in mbus_serial_recv_frame
     term->c_cc[VMIN] = (cc_t) 0;
+    term->c_cc[VTIME] = (cc_t) 0;
 
-    // Wait at most 0.2 sec.Note that it starts after first received byte!!
-    // I.e. if CMIN>0 and there are no data we would still wait forever...
-    //
     // The specification mentions link layer response timeout this way:
     // The time structure of various link layer communication types is described in EN60870-5-1. The answer time
     // between the end of a master send telegram and the beginning of the response telegram of the slave shall be
@@ -76,9 +87,7 @@ mbus_serial_connect(mbus_handle *handle)
     // result in additional delay of 100 ms in worst case.
     //
     // For 2400Bd this means (330 + 11) / 2400 + 0.15 = 292 ms (added 11 bit periods to receive first byte).
-    // I.e. timeout of 0.3s seems appropriate for 2400Bd.
-
-    term->c_cc[VTIME] = (cc_t) 3; // Timeout in 1/10 sec
+    mbus_serial_set_timeouts(serial_data, 2400);
 
     cfsetispeed(term, B2400);
     cfsetospeed(term, B2400);
@@ -116,42 +125,34 @@ mbus_serial_set_baudrate(mbus_handle *handle, long baudrate)
     {
         case 300:
             speed = B300;
-            serial_data->t.c_cc[VTIME] = (cc_t) 13; // Timeout in 1/10 sec
             break;
 
         case 600:
             speed = B600;
-            serial_data->t.c_cc[VTIME] = (cc_t) 8;  // Timeout in 1/10 sec
             break;
 
         case 1200:
             speed = B1200;
-            serial_data->t.c_cc[VTIME] = (cc_t) 5;  // Timeout in 1/10 sec
             break;
 
         case 2400:
             speed = B2400;
-            serial_data->t.c_cc[VTIME] = (cc_t) 3;  // Timeout in 1/10 sec
             break;
 
         case 4800:
             speed = B4800;
-            serial_data->t.c_cc[VTIME] = (cc_t) 3;  // Timeout in 1/10 sec
             break;
 
         case 9600:
             speed = B9600;
-            serial_data->t.c_cc[VTIME] = (cc_t) 2;  // Timeout in 1/10 sec
             break;
 
         case 19200:
             speed = B19200;
-            serial_data->t.c_cc[VTIME] = (cc_t) 2;  // Timeout in 1/10 sec
             break;
 
         case 38400:
             speed = B38400;
-            serial_data->t.c_cc[VTIME] = (cc_t) 2;  // Timeout in 1/10 sec
             break;
 
        default:
@@ -176,6 +177,8 @@ mbus_serial_set_baudrate(mbus_handle *handle, long baudrate)
         return -1;
     }
 
+    mbus_serial_set_timeouts(serial_data, baudrate);
+
     return 0;
 }
 
@@ -287,9 +290,11 @@ mbus_serial_send_frame(mbus_handle *handle, mbus_frame *frame)
 int
 mbus_serial_recv_frame(mbus_handle *handle, mbus_frame *frame)
 {
-    char buff[PACKET_BUFF_SIZE];
-    int remaining, timeouts;
-    ssize_t len, nread;
+    mbus_serial_data *serial_data;
+    mbus_frame_stream *stream;
+    struct pollfd pfd;
+    int remaining, timeout, res;
+    ssize_t nread;
 
     if (handle == NULL || frame == NULL)
     {
@@ -304,79 +309,76 @@ mbus_serial_recv_frame(mbus_handle *handle, mbus_frame *frame)
         return MBUS_RECV_RESULT_ERROR;
     }
 
-    memset((void *)buff, 0, sizeof(buff));
+    serial_data = (mbus_serial_data *) handle->auxdata;
+    stream = &(serial_data->stream);
 
     //
-    // read data until a packet is received
+    // read data until a packet is received, each read returns all bytes
+    // available (up to the free space in the buffer). Wait for the response
+    // window first, then for the next bytes of the frame.
     //
-    remaining = 1; // start by reading 1 byte
-    len = 0;
-    timeouts = 0;
+    pfd.fd = handle->fd;
+    pfd.events = POLLIN;
+    timeout = stream->len ? serial_data->byte_timeout : serial_data->response_timeout;
 
-    do {
-        if (len + remaining > PACKET_BUFF_SIZE)
+    while ((remaining = mbus_frame_stream_parse(stream, frame)) > 0)
+    {
+        res = poll(&pfd, 1, timeout);
+        if (res == -1)
         {
-            // avoid out of bounds access
+            if (errno == EINTR)
+                continue;
+            mbus_frame_stream_reset(stream);
             return MBUS_RECV_RESULT_ERROR;
         }
 
-        //printf("%s: Attempt to read %d bytes [len = %d]\n", __PRETTY_FUNCTION__, remaining, len);
-
-        if ((nread = read(handle->fd, &buff[len], remaining)) == -1)
+        if (res == 0)
         {
-       //     fprintf(stderr, "%s: aborting recv frame (remaining = %d, len = %d, nread = %d)\n",
-         //          __PRETTY_FUNCTION__, remaining, len, nread);
-            return MBUS_RECV_RESULT_ERROR;
+            // timeout
+            break;
         }
 
-//   printf("%s: Got %d byte [remaining %d, len %d]\n", __PRETTY_FUNCTION__, nread, remaining, len);
-
-        if (nread == 0)
+        if ((nread = read(handle->fd, &(stream->data[stream->len]), sizeof(stream->data) - stream->len)) == -1)
         {
-            timeouts++;
-
-            if (timeouts >= 3)
-            {
-                // abort to avoid endless loop
-                fprintf(stderr, "%s: Timeout\n", __PRETTY_FUNCTION__);
-                break;
-            }
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            mbus_frame_stream_reset(stream);
+            return MBUS_RECV_RESULT_ERROR;
         }
 
-        if (len > (SSIZE_MAX-nread))
+        if (nread == 0)
         {
-            // avoid overflow
-            return MBUS_RECV_RESULT_ERROR;
+            // device has been closed
+            break;
         }
 
-        len += nread;
-
-    } while ((remaining = mbus_parse(frame, buff, len)) > 0);
+        stream->len += nread;
+        timeout = serial_data->byte_timeout;
+    }
 
-    if (len == 0)
+    if (stream->len == 0)
     {
         // No data received
         return MBUS_RECV_RESULT_TIMEOUT;
     }
 
-    //
-    // call the receive event function, if the callback function is registered
-    //
-    if (handle->recv_event)
-        handle->recv_event(MBUS_HANDLE_TYPE_SERIAL, buff, len);
-
     if (remaining != 0)
     {
         // Would be OK when e.g. scanning the bus, otherwise it is a failure.
         // printf("%s: M-Bus layer failed to receive complete data.\n", __PRETTY_FUNCTION__);
+        if (handle->recv_event)
+            handle->recv_event(MBUS_HANDLE_TYPE_SERIAL, (const char *)stream->data, stream->len);
+        mbus_frame_stream_reset(stream);
         return MBUS_RECV_RESULT_INVALID;
     }
 
-    if (len == -1)
-    {
-        fprintf(stderr, "%s: M-Bus layer failed to parse data.\n", __PRETTY_FUNCTION__);
-        return MBUS_RECV_RESULT_ERROR;
-    }
+    //
+    // call the receive event function, if the callback function is registered
+    //
+    if (handle->recv_event)
+        handle->recv_event(MBUS_HANDLE_TYPE_SERIAL, (const char *)stream->data, stream->frame_size);
+
+    mbus_frame_stream_next(stream);
 
     return MBUS_RECV_RESULT_OK;
 }
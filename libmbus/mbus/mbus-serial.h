@@ -27,10 +27,24 @@ extern "C" {
 #endif
 
 
+//
+// receive timeouts according to EN60870-5-1: the answer of a slave has to
+// start between 11 and 330 bit times + 50ms after the end of the request,
+// there should be no pause between the characters of a frame. USB to serial
+// adapters may add some delay and deliver the data in chunks.
+//
+#define MBUS_SERIAL_RESPONSE_BITS     (330 + 11)  // response window + first character
+#define MBUS_SERIAL_RESPONSE_EXTRA_MS 150         // 50ms from the spec + 100ms for USB adapters
+#define MBUS_SERIAL_BYTE_BITS         11          // one character
+#define MBUS_SERIAL_BYTE_EXTRA_MS     50          // USB adapters
+
 typedef struct _mbus_serial_data
 {
     char *device;
     struct termios t;
+    mbus_frame_stream stream;   // received data
+    int response_timeout;       // ms until the first byte of a response
+    int byte_timeout;           // ms between bytes of a response
 } mbus_serial_data;
 
 int  mbus_serial_connect(mbus_handle *handle);
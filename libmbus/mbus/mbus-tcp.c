@@ -53,6 +53,7 @@ mbus_tcp_connect(mbus_handle *handle)
 
     host = tcp_data->host;
     port = tcp_data->port;
+    mbus_frame_stream_reset(&(tcp_data->stream));
 
     //
     // create the TCP connection
@@ -183,37 +184,33 @@ mbus_tcp_send_frame(mbus_handle *handle, mbus_frame *frame)
 //------------------------------------------------------------------------------
 int mbus_tcp_recv_frame(mbus_handle *handle, mbus_frame *frame)
 {
-    char buff[PACKET_BUFF_SIZE];
+    mbus_tcp_data *tcp_data;
+    mbus_frame_stream *stream;
     int remaining;
-    ssize_t len, nread;
+    ssize_t nread;
 
     if (handle == NULL || frame == NULL) {
         fprintf(stderr, "%s: Invalid parameter.\n", __PRETTY_FUNCTION__);
         return MBUS_RECV_RESULT_ERROR;
     }
 
-    memset((void *) buff, 0, sizeof(buff));
+    tcp_data = (mbus_tcp_data *) handle->auxdata;
+    stream = &(tcp_data->stream);
 
     //
-    // read data until a packet is received
+    // read data until a packet is received, gateways usually deliver the
+    // whole frame with one read
     //
-    remaining = 1; // start by reading 1 byte
-    len = 0;
-
-    do {
+    while ((remaining = mbus_frame_stream_parse(stream, frame)) > 0) {
 retry:
-        if (len + remaining > PACKET_BUFF_SIZE)
-        {
-            // avoid out of bounds access
-            return MBUS_RECV_RESULT_ERROR;
-        }
-
-        nread = read(handle->fd, &buff[len], remaining);
+        nread = read(handle->fd, &(stream->data[stream->len]), sizeof(stream->data) - stream->len);
         switch (nread) {
         case -1:
             if (errno == EINTR)
                 goto retry;
 
+            mbus_frame_stream_reset(stream);
+
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 mbus_error_str_set("M-Bus tcp transport layer response timeout has been reached.");
                 return MBUS_RECV_RESULT_TIMEOUT;
@@ -222,30 +219,30 @@ retry:
             mbus_error_str_set("M-Bus tcp transport layer failed to read data.");
             return MBUS_RECV_RESULT_ERROR;
         case 0:
+            mbus_frame_stream_reset(stream);
             mbus_error_str_set("M-Bus tcp transport layer connection closed by remote host.");
             return MBUS_RECV_RESULT_RESET;
         default:
-            if (len > (SSIZE_MAX-nread))
-            {
-                // avoid overflow
-                return MBUS_RECV_RESULT_ERROR;
-            }
-
-            len += nread;
+            stream->len += nread;
         }
-    } while ((remaining = mbus_parse(frame, buff, len)) > 0);
-
-    //
-    // call the receive event function, if the callback function is registered
-    //
-    if (handle->recv_event)
-        handle->recv_event(MBUS_HANDLE_TYPE_TCP, buff, len);
+    }
 
     if (remaining < 0) {
+        //
+        // call the receive event function, if the callback function is registered
+        //
+        if (handle->recv_event)
+            handle->recv_event(MBUS_HANDLE_TYPE_TCP, (const char *)stream->data, stream->len);
+        mbus_frame_stream_reset(stream);
         mbus_error_str_set("M-Bus layer failed to parse data.");
         return MBUS_RECV_RESULT_INVALID;
     }
 
+    if (handle->recv_event)
+        handle->recv_event(MBUS_HANDLE_TYPE_TCP, (const char *)stream->data, stream->frame_size);
+
+    mbus_frame_stream_next(stream);
+
     return MBUS_RECV_RESULT_OK;
 }
 
@@ -30,6 +30,7 @@ typedef struct _mbus_tcp_data
 {
     char *host;
     uint16_t port;
+    mbus_frame_stream stream;   // received data
 } mbus_tcp_data;
 
 int  mbus_tcp_connect(mbus_handle *handle);
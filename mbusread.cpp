@@ -10,6 +10,8 @@
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
 #include "global.h"
 #include "math.h"
 
@@ -61,8 +63,6 @@ int mbus_ping_address(mbus_handle *handle, mbus_frame *reply, int address)
 }
 
 
-mbus_handle *mb_Serial;
-
 typedef struct meterIPConnection_t meterIPConnection_t;
 struct meterIPConnection_t {
 	char * hostname;
@@ -75,9 +75,12 @@ struct meterIPConnection_t {
 
 meterIPConnection_t * meterIPconnections;
 
+// meters on different buses are queried in parallel threads
+static pthread_mutex_t tcpMutex = PTHREAD_MUTEX_INITIALIZER;
+
 const char * defPort = "502";
 
-mbus_handle ** mbusTCP_open (char *device, char *port) {
+static mbus_handle ** mbusTCP_open_locked (char *device, char *port) {
 	int res;
 	meterIPConnection_t * mc = meterIPconnections;
 
@@ -135,6 +138,16 @@ mbus_handle ** mbusTCP_open (char *device, char *port) {
 }
 
 
+mbus_handle ** mbusTCP_open (char *device, char *port) {
+	mbus_handle ** mb;
+
+	pthread_mutex_lock(&tcpMutex);
+	mb = mbusTCP_open_locked(device,port);
+	pthread_mutex_unlock(&tcpMutex);
+	return mb;
+}
+
+
 void mbusTCP_freeAll() {
 	meterIPConnection_t * mc = meterIPconnections;
 	meterIPConnection_t * mcWork;
@@ -176,41 +189,728 @@ int msleep(long msec)
 }
 
 
+uint64_t getMonotonicMs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
 //*****************************************************************************
 
+typedef struct meterSerialConnection_t meterSerialConnection_t;
+struct meterSerialConnection_t {
+	char * device;
+	int baud;			// base rate, meters with another baud rate will be switched
+	int curBaud;		// current rate of the port
+	mbus_handle *mb;
+	meterSerialConnection_t *next;
+};
+
+meterSerialConnection_t * meterSerialConnections;	// first one is the default port (--device)
+
+static mbus_handle *mb_SerialNone;		// returned by mbusSerial_getmh if no default port has been opened
+
 mbus_handle ** mbusSerial_getmh() {
-	return &mb_Serial;
+	if (meterSerialConnections) return &meterSerialConnections->mb;
+	return &mb_SerialNone;
 }
 
-int mbusSerial_open (const char *device, int baud) {
+static mbus_handle * mbusSerial_openDevice (const char *device, int baud) {
+	mbus_handle *mb;
 
-	if ((mb_Serial = mbus_context_serial(device)) == NULL) {
+	if ((mb = mbus_context_serial(device)) == NULL) {
         fprintf(stderr,"mbusSerial_open failed: Could not initialize M-Bus context for %s (%s)\n", device, mbus_error_str());
         exit(1);
     }
 
-    if (mbus_connect(mb_Serial) == -1) {		// sets B2400
+    if (mbus_connect(mb) == -1) {		// sets B2400
         fprintf(stderr,"\nFailed to configure serial port %s @ %d baud (%s)\n",device,baud,strerror(errno));
         exit(1);
     }
 
 
-    if (mbus_serial_set_baudrate(mb_Serial, baud) == -1) {
+    if (mbus_serial_set_baudrate(mb, baud) == -1) {
         fprintf(stderr,"Failed to set baud rate of %d for %s (%s).\n",baud,device,strerror(errno));
         exit(1);
     }
 
 	VPRINTFN(7,"mbusSerial_open: %s opened (B%d)",device,baud);
+	return mb;
+}
+
+// get the handle for a serial port, the port will be opened if not yet in the list of serial connections
+// device NULL is the default port (--device), returns NULL if the default port has not been opened
+mbus_handle ** mbusSerial_get (const char *device, int baud) {
+	meterSerialConnection_t * sc = meterSerialConnections;
+
+	if (device == NULL) {
+		if (sc == NULL) return NULL;
+		device = sc->device;
+	}
+
+	while (sc) {
+		if (strcmp(device,sc->device) == 0) return &sc->mb;
+		if (sc->next == NULL) break;
+		sc = sc->next;
+	}
+
+	if (sc) {
+		sc->next = (meterSerialConnection_t *)calloc(1,sizeof(meterSerialConnection_t));
+		sc = sc->next;
+	} else {
+		meterSerialConnections = (meterSerialConnection_t *)calloc(1,sizeof(meterSerialConnection_t));
+		sc = meterSerialConnections;
+	}
+	sc->device = strdup(device);
+	sc->baud = baud;
+	sc->curBaud = baud;
+	sc->mb = mbusSerial_openDevice(device,baud);
+	return &sc->mb;
+}
+
+// retune a serial port, only called by the thread querying the port
+int mbusSerial_setBaud (mbus_handle **mb, int baud) {
+	meterSerialConnection_t * sc = meterSerialConnections;
+
+	while (sc) {
+		if (&sc->mb == mb) {
+			if (sc->curBaud == baud) return 0;
+			if (mbus_serial_set_baudrate(sc->mb, baud) == -1) {
+				EPRINTFN("Failed to set baud rate of %d for %s",baud,sc->device);
+				return -1;
+			}
+			VPRINTFN(4,"%s: switched to %d baud",sc->device,baud);
+			sc->curBaud = baud;
+			return 0;
+		}
+		sc = sc->next;
+	}
+	return -1;
+}
+
+// returns the device name for a serial handle returned by mbusSerial_get or mbusSerial_getmh
+const char * mbusSerial_getDeviceName (mbus_handle **mb) {
+	meterSerialConnection_t * sc = meterSerialConnections;
+
+	while (sc) {
+		if (&sc->mb == mb) return sc->device;
+		sc = sc->next;
+	}
+	return "serial";
+}
+
+// returns the baud rate for a serial handle returned by mbusSerial_get or mbusSerial_getmh
+int mbusSerial_getBaud (mbus_handle **mb) {
+	meterSerialConnection_t * sc = meterSerialConnections;
+
+	while (sc) {
+		if (&sc->mb == mb) return sc->baud;
+		sc = sc->next;
+	}
+	return 2400;
+}
+
+// open the default serial port
+int mbusSerial_open (const char *device, int baud) {
+	if (meterSerialConnections) {
+		EPRINTFN("mbusSerial_open: default serial port already opened");
+		return -1;
+	}
+	mbusSerial_get(device,baud);
 	return 0;
 }
 
 
 void mbusSerial_close() {
-	if (mb_Serial) {
-		mbus_disconnect(mb_Serial);
-		mbus_context_free(mb_Serial);
-		mb_Serial = NULL;
+	meterSerialConnection_t * sc = meterSerialConnections;
+	meterSerialConnection_t * scWork;
+
+	while (sc) {
+		scWork = sc;
+		sc = sc->next;
+		if (scWork->mb) {
+			mbus_disconnect(scWork->mb);
+			mbus_context_free(scWork->mb);
+		}
+		free(scWork->device);
+		free(scWork);
+	}
+	meterSerialConnections = NULL;
+}
+
+//*****************************************************************************
+// free list for the records allocated by libmbus while parsing a telegram,
+// records are freed after each telegram and will be reused for the next one.
+// Each poll thread has its own list, a bus is queried by one thread at a time
+
+#define RECORD_POOL_MAX (MBUS_FRAME_DATA_LENGTH / 2)	// max records per telegram
+
+static __thread mbus_data_record *recordPool;
+static __thread int recordPoolSize;
+
+static mbus_data_record * mbusRecord_alloc() {
+	mbus_data_record *record = recordPool;
+
+	if (record) {
+		recordPool = (mbus_data_record *)record->next;
+		recordPoolSize--;
+		return record;
+	}
+	return (mbus_data_record *)malloc(sizeof(mbus_data_record));
+}
+
+
+static void mbusRecord_release(mbus_data_record *record) {
+	if (recordPoolSize >= RECORD_POOL_MAX) {
+		free(record);
+		return;
+	}
+	record->next = recordPool;
+	recordPool = record;
+	recordPoolSize++;
+}
+
+
+// use the free list for records allocated by libmbus
+void mbusRecord_init() {
+	mbus_register_record_allocator(mbusRecord_alloc,mbusRecord_release);
+}
+
+
+// free the records of the calling thread
+void mbusRecord_freePool() {
+	mbus_data_record *record;
+
+	while (recordPool) {
+		record = recordPool;
+		recordPool = (mbus_data_record *)record->next;
+		free(record);
+	}
+	recordPoolSize = 0;
+}
+
+//*****************************************************************************
+
+meterBus_t *meterBuses;
+
+// add a meter to the bus (serial port or TCP gateway) it is connected to, the bus will be created if not yet existing
+void mbusBus_add (meter_t *meter) {
+	meterBus_t *bus = meterBuses;
+	meterBus_t *busLast = NULL;
+	meterList_t *ml;
+	char name[255];
+
+	if (meter->isTCP)
+		snprintf(name,sizeof(name),"%s:%s",meter->hostname,meter->port == NULL ? defPort : meter->port);
+	else
+		snprintf(name,sizeof(name),"%s",mbusSerial_getDeviceName(meter->mb));
+
+	while (bus) {
+		if (strcmp(bus->name,name) == 0) break;
+		busLast = bus;
+		bus = bus->next;
+	}
+	if (!bus) {
+		bus = (meterBus_t *)calloc(1,sizeof(meterBus_t));
+		bus->name = strdup(name);
+		bus->isTCP = meter->isTCP;
+		if (! bus->isTCP) {
+			bus->baud = mbusSerial_getBaud(meter->mb);
+			bus->gapMin = (GAP_BITS_MIN * 1000 + bus->baud - 1) / bus->baud + GAP_MS_MIN;
+		}
+		bus->statStart = getMonotonicMs();
+		if (busLast) busLast->next = bus;
+		else {
+			meterBuses = bus;
+			mbusRecord_init();
+		}
+		VPRINTFN(4,"mbusBus_add: new bus %s",bus->name);
+	}
+
+	ml = (meterList_t *)calloc(1,sizeof(meterList_t));
+	ml->meter = meter;
+	meter->gap = meter->gapFixed ? meter->gapFixed : GAP_MS_INIT;
+	if (meter->gap < bus->gapMin) meter->gap = bus->gapMin;
+	if (bus->meters) {
+		meterList_t *ml1 = bus->meters;
+		while (ml1->next) ml1 = ml1->next;
+		ml1->next = ml;
+	} else bus->meters = ml;
+	meter->bus = bus;
+}
+
+
+void mbusBus_freeAll() {
+	meterBus_t *bus,*busNext;
+	meterList_t *ml,*mlNext;
+
+	mbusPoll_stopThreads();
+	mbusRecord_freePool();
+	bus = meterBuses;
+	while (bus) {
+		busNext = bus->next;
+		ml = bus->meters;
+		while (ml) {
+			mlNext = ml->next;
+			free(ml);
+			ml = mlNext;
+		}
+		free(bus->name);
+		free(bus->due);
+		free(bus);
+		bus = busNext;
+	}
+	meterBuses = NULL;
+}
+
+
+void mbusBus_showStats() {
+	meterBus_t *bus = meterBuses;
+	meterList_t *ml;
+	uint64_t now = getMonotonicMs();
+	double duty;
+
+	printf( "Bus statistics\n" \
+			"Bus                             Baud  Duty%% Telegrams Timeouts Collisions Selects  Cached\n" \
+			"------------------------------------------------------------------------------------------\n");
+	while (bus) {
+		duty = now > bus->statStart ? (double)bus->busyMs * 100.0 / (now - bus->statStart) : 0;
+		printf("%-30s %6d %6.1f %9u %8u %10u %7u %7u\n",bus->name,bus->baud,duty,bus->numTelegrams,bus->numTimeouts,bus->numCollisions,bus->numSelects,bus->numCached);
+		if (! bus->isTCP) {
+			ml = bus->meters;
+			while (ml) {
+				printf("  %-28s gap %4d ms%s, %d baud\n",ml->meter->name,ml->meter->gap,ml->meter->gapFixed ? " (fixed)" : "",
+					ml->meter->curBaud ? ml->meter->curBaud : ml->meter->serBaud);
+				ml = ml->next;
+			}
+		}
+		bus = bus->next;
+	}
+}
+
+
+// wait until the gap between the last telegram on the bus and the next one has elapsed
+static void mbusBus_waitGap(meter_t *meter) {
+	meterBus_t *bus = meter->bus;
+	uint64_t now;
+
+	if (! bus) return;
+	now = getMonotonicMs();
+	if (now < bus->lastTelegram + meter->gap) msleep(bus->lastTelegram + meter->gap - now);
+}
+
+
+// update bus statistics and adapt the gap of the meter to the result of the last telegram
+static void mbusBus_telegramDone(meter_t *meter, uint64_t telegramStart, int res) {
+	meterBus_t *bus = meter->bus;
+
+	if (! bus) return;
+	bus->lastTelegram = getMonotonicMs();
+	bus->busyMs += bus->lastTelegram - telegramStart;
+	bus->numTelegrams++;
+	switch (res) {
+		case MBUS_RECV_RESULT_OK:
+			// approach the minimum gap while the meter answers
+			if (! meter->gapFixed) meter->gap -= (meter->gap - bus->gapMin) / 4;
+			break;
+		case MBUS_RECV_RESULT_TIMEOUT:
+			bus->numTimeouts++;
+			if (! meter->gapFixed && meter->gap < GAP_MS_MAX) meter->gap = meter->gap * 2 > GAP_MS_MAX ? GAP_MS_MAX : meter->gap * 2;
+			break;
+		default:
+			bus->numCollisions++;
+			if (! meter->gapFixed && meter->gap < GAP_MS_MAX) meter->gap = meter->gap * 2 > GAP_MS_MAX ? GAP_MS_MAX : meter->gap * 2;
+	}
+	VPRINTFN(4,"%s: recv result %d, gap %d ms",meter->name,res,meter->gap);
+}
+
+
+// select a meter by its secondary address unless it is still selected on the bus
+static int mbusBus_select(meter_t *meter) {
+	meterBus_t *bus = meter->bus;
+	uint64_t telegramStart;
+	int res;
+
+	if (bus && strcmp(bus->selected,meter->secondaryAddr) == 0) {
+		VPRINTFN(4,"%s: %s is still selected",meter->name,meter->secondaryAddr);
+		return 0;
+	}
+	if (bus) bus->selected[0] = 0;
+	if (! meter->isTCP) mbusBus_waitGap(meter);
+	telegramStart = getMonotonicMs();
+	res = mbus_select_secondary_address(*meter->mb,meter->secondaryAddr);
+	mbusBus_telegramDone(meter,telegramStart,res == MBUS_PROBE_SINGLE ? MBUS_RECV_RESULT_OK :
+		res == MBUS_PROBE_COLLISION ? MBUS_RECV_RESULT_INVALID : MBUS_RECV_RESULT_TIMEOUT);
+	if (res != MBUS_PROBE_SINGLE) {
+		EPRINTFN("%s: failed to select secondary address %s (%s)",meter->name,meter->secondaryAddr,
+			res == MBUS_PROBE_COLLISION ? "more than one device matches" : res == MBUS_PROBE_NOTHING ? "no device matches" : "error");
+		return -1;
+	}
+	VPRINTFN(4,"%s: selected %s",meter->name,meter->secondaryAddr);
+	if (bus) {
+		strcpy(bus->selected,meter->secondaryAddr);
+		bus->numSelects++;
+	}
+	return 0;
+}
+
+
+// check if the header of a variable data response matches the (masked) secondary address
+static int mbus_secondaryMatches(const char *mask, mbus_data_variable_header *header) {
+	char addr[17];
+	int i;
+
+	snprintf(addr,sizeof(addr),"%08llX%02X%02X%02X%02X",
+		mbus_data_bcd_decode_hex(header->id_bcd,4),
+		header->manufacturer[0],header->manufacturer[1],header->version,header->medium);
+	for (i=0;i<16;i++)
+		if (mask[i] != 'F' && mask[i] != addr[i]) return 0;
+	return 1;
+}
+
+#define MBUS_DIF_SELECTION_READOUT 0x08		// data field for selection for readout (master to slave)
+#define MBUS_DIF_GLOBAL_READOUT    0x7F		// global readout request (master to slave)
+
+// encode the data record header for data selection and matching, the data field of the DIF is cleared
+static int mbusSel_encode(mbus_data_record *record, unsigned char *drh) {
+	int len = 0;
+	size_t n;
+
+	if ((record->drh.dib.dif & 0x0F) == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) return -1;	// including more records follow and idle filler
+	if ((record->drh.vib.vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) == 0x7C) return -1;		// plain text VIF
+	drh[len++] = record->drh.dib.dif & 0xF0;
+	for (n=0;n<record->drh.dib.ndife;n++) drh[len++] = record->drh.dib.dife[n];
+	drh[len++] = record->drh.vib.vif;
+	for (n=0;n<record->drh.vib.nvife;n++) drh[len++] = record->drh.vib.vife[n];
+	return len;
+}
+
+
+static int mbusSel_isRequired(meter_t *meter, int recordNumber) {
+	meterRegisterRead_t *rr;
+
+	for (rr = meter->registerRead; rr; rr = rr->next)
+		if (! rr->registerDef->isFormulaOnly && rr->registerDef->recordNumber == recordNumber) return 1;
+	return 0;
+}
+
+
+static void mbusSel_addHeader(meterSelRecord_t **records, int *numRecords, int recordNumber, unsigned char *drh, int len) {
+	meterSelRecord_t *sr;
+
+	*records = (meterSelRecord_t *)realloc(*records,(*numRecords + 1) * sizeof(meterSelRecord_t));
+	sr = &(*records)[(*numRecords)++];
+	sr->recordNumber = recordNumber;
+	sr->drhLen = len;
+	memcpy(sr->drh,drh,len);
+}
+
+
+static void mbusSel_disable(meter_t *meter) {
+	meter->selState = SEL_OFF;
+	free(meter->selSeen);
+	meter->selSeen = NULL;
+	meter->numSelSeen = 0;
+}
+
+
+// save the headers of the records required by the meter type from a full readout. The selection can not be
+// used if a required record can not be selected or if any other record of the readout has the same header,
+// the meter would return the first record with this header
+static void mbusSel_learn(meter_t *meter, mbus_data_variable *data, int recordNumber) {
+	mbus_data_record *record;
+	meterSelRecord_t *sr;
+	unsigned char drh[SEL_DRH_MAX];
+	int i,len,required;
+
+	if (recordNumber == 0) {	// (re)start of the readout, e.g. after switching to multi telegram readout
+		meter->numSelRecords = 0;
+		meter->numSelSeen = 0;
+	}
+	for (record = data->record; record; record = (mbus_data_record *)record->next, recordNumber++) {
+		required = mbusSel_isRequired(meter,recordNumber);
+		len = mbusSel_encode(record,drh);
+		if (len < 0) {
+			if (! required) continue;
+			LOGN(0,"%s: record %d can not be selected, selective readout disabled",meter->name,recordNumber);
+			mbusSel_disable(meter);
+			return;
+		}
+		for (i=0;i<meter->numSelSeen;i++) {
+			sr = &meter->selSeen[i];
+			if (sr->drhLen == len && memcmp(sr->drh,drh,len) == 0) break;
+		}
+		if (i < meter->numSelSeen) {
+			if (required || mbusSel_isRequired(meter,sr->recordNumber)) {
+				LOGN(0,"%s: records %d and %d have the same header, selective readout disabled",meter->name,sr->recordNumber,recordNumber);
+				mbusSel_disable(meter);
+				return;
+			}
+		} else
+			mbusSel_addHeader(&meter->selSeen,&meter->numSelSeen,recordNumber,drh,len);
+		if (required) mbusSel_addHeader(&meter->selRecords,&meter->numSelRecords,recordNumber,drh,len);
+	}
+}
+
+
+// check if all records required by the meter type have been learned
+static void mbusSel_learnDone(meter_t *meter) {
+	meterRegisterRead_t *rr;
+	int i;
+
+	for (rr = meter->registerRead; rr; rr = rr->next) {
+		if (rr->registerDef->isFormulaOnly) continue;
+		for (i=0;i<meter->numSelRecords;i++)
+			if (meter->selRecords[i].recordNumber == rr->registerDef->recordNumber) break;
+		if (i == meter->numSelRecords) {
+			LOGN(0,"%s: record %d not received, selective readout disabled",meter->name,rr->registerDef->recordNumber);
+			mbusSel_disable(meter);
+			return;
+		}
+	}
+	VPRINTFN(1,"%s: %d records will be selected for readout",meter->name,meter->numSelRecords);
+	free(meter->selSeen);
+	meter->selSeen = NULL;
+	meter->numSelSeen = 0;
+	meter->selFound = (char *)realloc(meter->selFound,meter->numSelRecords + 1);
+	meter->selResponses = 0;
+	meter->selState = SEL_SEND;
+}
+
+
+// the response does not match the data selection. If this is the first readout after the selection has been
+// sent, the meter does not support it, otherwise the selection has been lost and will be sent again
+static void mbusSel_failed(meter_t *meter) {
+	if (meter->selResponses == 0) {
+		LOGN(0,"%s: data selection ignored by the meter, using full readout",meter->name);
+		meter->selState = SEL_RESET;
+	} else {
+		VPRINTFN(1,"%s: data selection lost, will be sent again",meter->name);
+		meter->selResponses = 0;
+		meter->selState = SEL_SEND;
+	}
+}
+
+
+static void mbusSel_setFound(meter_t *meter, int recordNumber) {
+	int i;
+
+	for (i=0;i<meter->numSelRecords;i++)
+		if (meter->selRecords[i].recordNumber == recordNumber) meter->selFound[i] = 1;
+}
+
+
+// check if all selected records have been received in the current readout
+static int mbusSel_complete(meter_t *meter) {
+	int i;
+
+	for (i=0;i<meter->numSelRecords;i++)
+		if (! meter->selFound[i]) return 0;
+	return 1;
+}
+
+
+// map the records of a response to the data selection to record numbers. Returns 0 if only selected records
+// have been received, each of them once within the readout (multi telegram)
+static int mbusSel_map(meter_t *meter, mbus_data_variable *data, int *map, int mapSize) {
+	mbus_data_record *record;
+	unsigned char drh[SEL_DRH_MAX];
+	char *found = meter->selFound;
+	int i,k,len,res = 0;
+
+	for (record = data->record, k = 0; record; record = (mbus_data_record *)record->next, k++) {
+		if (k >= mapSize) {
+			res = -1;
+			break;
+		}
+		map[k] = -1;
+		len = mbusSel_encode(record,drh);
+		if (len < 0) {
+			if (record->drh.dib.dif != MBUS_DIB_DIF_IDLE_FILLER) res = -1;
+			continue;
+		}
+		for (i=0;i<meter->numSelRecords;i++)
+			if (! found[i] && meter->selRecords[i].drhLen == len && memcmp(meter->selRecords[i].drh,drh,len) == 0) break;
+		if (i == meter->numSelRecords) {
+			res = -1;
+			continue;
+		}
+		found[i] = 1;
+		map[k] = meter->selRecords[i].recordNumber;
+	}
+	return res;
+}
+
+
+// wait for the acknowledge of a SND_UD or SND_NKE
+static int mbusMeter_recvAck(meter_t *meter, uint64_t telegramStart) {
+	mbus_frame reply;
+	int res;
+
+	res = mbus_recv_frame(*meter->mb, &reply);
+	mbusBus_telegramDone(meter,telegramStart,res);
+	if (res == MBUS_RECV_RESULT_INVALID && ! meter->isTCP) mbus_purge_frames(*meter->mb);
+	if (res != MBUS_RECV_RESULT_OK || mbus_frame_type(&reply) != MBUS_FRAME_TYPE_ACK) return -1;
+	return 0;
+}
+
+
+// send the data selection (SEL_SEND) or a global readout request (SEL_RESET) as SND_UD with the given FCB,
+// returns 0 if acknowledged
+static int mbusSel_send(meter_t *meter, int fcb) {
+	unsigned char data[MBUS_FRAME_DATA_LENGTH];
+	size_t len = 0;
+	uint64_t telegramStart;
+	mbus_frame *frame;
+	int i,res;
+
+	if (meter->selState == SEL_RESET)
+		data[len++] = MBUS_DIF_GLOBAL_READOUT;
+	else
+		for (i=0;i<meter->numSelRecords;i++) {
+			if (len + meter->selRecords[i].drhLen > sizeof(data)) {
+				LOGN(0,"%s: data selection exceeds the frame size, selective readout disabled",meter->name);
+				meter->selState = SEL_OFF;
+				return -1;
+			}
+			memcpy(&data[len],meter->selRecords[i].drh,meter->selRecords[i].drhLen);
+			data[len] |= MBUS_DIF_SELECTION_READOUT;
+			len += meter->selRecords[i].drhLen;
+		}
+	if (! meter->isTCP) mbusBus_waitGap(meter);
+	telegramStart = getMonotonicMs();
+	frame = mbus_frame_new(MBUS_FRAME_TYPE_LONG);
+	if (frame == NULL) return -1;
+	frame->control = MBUS_CONTROL_MASK_SND_UD | MBUS_CONTROL_MASK_DIR_M2S | (fcb ? MBUS_CONTROL_MASK_FCB : 0);
+	frame->address = meter->mbusAddress;
+	frame->control_information = MBUS_CONTROL_INFO_DATA_SEND;
+	frame->data_size = len;
+	memcpy(frame->data,data,len);
+	res = mbus_send_frame(*meter->mb, frame);
+	mbus_frame_free(frame);
+	if (res == 0) res = mbusMeter_recvAck(meter,telegramStart);
+	if (meter->selState == SEL_RESET) {
+		VPRINTFN(1,"%s: global readout request %s",meter->name,res == 0 ? "sent" : "failed");
+		meter->selState = SEL_OFF;
+		return res;
+	}
+	if (res != 0) {
+		LOGN(0,"%s: data selection not acknowledged, selective readout disabled",meter->name);
+		meter->selState = SEL_OFF;
+		return res;
+	}
+	VPRINTFN(2,"%s: data selection sent (%d bytes)",meter->name,(int)len);
+	meter->selState = SEL_ACTIVE;
+	return 0;
+}
+
+char *baudCacheFile;		// baud rates meters have been switched to (switchbaud=), kept across restarts
+static pthread_mutex_t baudCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static int baudCacheDirty;		// a meter answered with another baud rate than saved
+
+static void mbusBaud_cacheKey(meter_t *meter, char *key, int keySize) {
+	if (meter->secondaryAddr) snprintf(key,keySize,"%s:%s",mbusSerial_getDeviceName(meter->mb),meter->secondaryAddr);
+	else snprintf(key,keySize,"%s:%d",mbusSerial_getDeviceName(meter->mb),(int)meter->mbusAddress);
+}
+
+
+void mbusBaud_loadCache() {
+	FILE *f;
+	meter_t *meter;
+	char line[512],name[300],key[300];
+	int baud;
+
+	if (! baudCacheFile) return;
+	f = fopen(baudCacheFile,"r");
+	if (! f) return;		// not yet written
+	while (fgets(line,sizeof(line),f)) {
+		if (sscanf(line,"%299s %d",name,&baud) != 2) continue;
+		for (meter = meters; meter; meter = meter->next) {
+			if (meter->isTCP || ! meter->switchBaud || ! meter->bus) continue;
+			mbusBaud_cacheKey(meter,key,sizeof(key));
+			if (strcmp(key,name) == 0) {
+				meter->curBaud = baud == meter->serBaud ? 0 : baud;
+				meter->cachedBaud = meter->curBaud;
+				VPRINTFN(2,"%s: using cached baud rate %d",meter->name,baud);
+			}
+		}
+	}
+	fclose(f);
+}
+
+
+// rewrite the cache file with the baud rates meters have answered with, called by the main thread
+// after all buses have been queried
+static void mbusBaud_saveCache() {
+	FILE *f;
+	meter_t *meter;
+	char key[300];
+
+	if (! baudCacheFile) return;
+	pthread_mutex_lock(&baudCacheMutex);
+	if (baudCacheDirty) {
+		baudCacheDirty = 0;
+		f = fopen(baudCacheFile,"w");
+		if (f) {
+			for (meter = meters; meter; meter = meter->next) {
+				if (meter->isTCP || ! meter->switchBaud || ! meter->cachedBaud || ! meter->bus) continue;
+				mbusBaud_cacheKey(meter,key,sizeof(key));
+				fprintf(f,"%s %d\n",key,meter->cachedBaud);
+			}
+			fclose(f);
+		} else
+			EPRINTFN("unable to write baud cache file %s (%s)",baudCacheFile,strerror(errno));
+	}
+	pthread_mutex_unlock(&baudCacheMutex);
+}
+
+
+// the meter answered with its current baud rate, the cache file will be updated after the cycle
+static void mbusBaud_confirm(meter_t *meter) {
+	if (meter->cachedBaud == meter->curBaud) return;
+	pthread_mutex_lock(&baudCacheMutex);
+	meter->cachedBaud = meter->curBaud;
+	baudCacheDirty = 1;
+	pthread_mutex_unlock(&baudCacheMutex);
+}
+
+
+// baud rate the meter currently uses
+static int mbusMeter_curBaud(meter_t *meter) {
+	return meter->curBaud ? meter->curBaud : meter->serBaud;
+}
+
+
+static void mbusMeter_setCurBaud(meter_t *meter, int baud) {
+	if (baud == meter->serBaud) baud = 0;
+	meter->curBaud = baud;
+}
+
+
+// switch the meter to switchBaud, the meter acknowledges with the old baud rate. If the command has been sent
+// but not acknowledged we assume the meter may already use the new rate, this will be reverted if the meter
+// does not answer with the new rate
+static void mbusMeter_switchBaud(meter_t *meter) {
+	uint64_t telegramStart;
+	int res,oldBaud = mbusMeter_curBaud(meter);
+
+	if (mbusSerial_setBaud(meter->mb,oldBaud) != 0) return;
+	mbusBus_waitGap(meter);
+	telegramStart = getMonotonicMs();
+	res = mbus_send_switch_baudrate_frame(*meter->mb, meter->mbusAddress, meter->switchBaud);
+	if (res != 0) {
+		EPRINTFN("%s: failed to send baud rate switch from %d to %d baud",meter->name,oldBaud,meter->switchBaud);
+		return;
+	}
+	res = mbusMeter_recvAck(meter,telegramStart);
+	if (res == 0) {
+		VPRINTFN(1,"%s: switched from %d to %d baud",meter->name,oldBaud,meter->switchBaud);
+	} else {
+		VPRINTFN(1,"%s: switching from %d to %d baud not acknowledged, trying %d baud",meter->name,oldBaud,meter->switchBaud,meter->switchBaud);
 	}
+	mbusMeter_setCurBaud(meter,meter->switchBaud);
 }
 
 
@@ -259,16 +959,72 @@ using namespace mu;
 
 static value_type Rnd(value_type v) { return v * std::rand() / (value_type)(RAND_MAX + 1.0); }
 
-// init the global parser and add all variables
-mu::Parser * initParser() {
+// meter formulas sorted by dependencies, formulas used by other formulas first
+meterFormula_t **formulaOrder;
+int numFormulaOrder;
+unsigned int formulaSeq;    // incremented for each evaluation of the meter formulas
+
+
+// find the register or meter formula for a variable name (MeterName.RegisterName)
+static double * formulaVarLookup(const char *name, meter_t **meter, meterFormula_t **mf) {
+    char meterName[255];
+    const char *dot = name;
+    meter_t *m;
+    meterRegisterRead_t *registerRead;
+    meterFormula_t *f;
+
+    while ((dot = strchr(dot,'.')) != NULL) {
+        snprintf(meterName,sizeof(meterName),"%.*s",(int)(dot - name),name);
+        dot++;
+        m = findMeter(meterName);
+        if (m && m->disabled == 0) {
+            for (registerRead = m->registerRead; registerRead; registerRead = registerRead->next)
+                if (strcmp(registerRead->registerDef->name,dot) == 0) {
+                    *meter = m; *mf = NULL;
+                    return &registerRead->fvalue;
+                }
+            for (f = m->meterFormula; f; f = f->next)
+                if (strcmp(f->name,dot) == 0) {
+                    *meter = m; *mf = f;
+                    return &f->fvalue;
+                }
+        }
+    }
+    return NULL;
+}
+
+
+// variable factory for the global parser, binds variables used by a formula on demand
+static value_type * formulaVarFactory(const char_type *name, void *userData) {
+    meter_t *meter;
+    meterFormula_t *mf;
+    double *var;
+
+    var = formulaVarLookup(name,&meter,&mf);
+    if (var == NULL) throw mu::ParserError(std::string("unknown variable ") + name);
+    return var;
+}
+
+
+// init the global parser, variables used by formulas (MeterName.VariableName) will be bound on demand,
+// allVariables adds all variables of all meters (needed for listing the variables in --formtry)
+mu::Parser * initParser(int allVariables) {
+    static int hasAllVariables;
     meterRegisterRead_t *registerRead;
+    meterFormula_t *mf,*f;
     meter_t *meter = meters;
+    meter_t *m;
     char name[255];
 
     if (parser == NULL) {
         parser = new (mu::Parser);
         parser-> DefineNameChars(MUPARSER_ALLOWED_CHARS);
         parser->DefineFun(_T("rnd"), Rnd, false);     // Add an unoptimizeable function
+        parser->SetVarFactory(formulaVarFactory, NULL);
+        hasAllVariables = 0;
+    }
+    if (allVariables && !hasAllVariables) {
+        hasAllVariables = 1;
         // add all variables using their fully qualified name (MeterName.VariableName)
         while (meter) {
             if (meter->disabled == 0) {
@@ -288,6 +1044,21 @@ mu::Parser * initParser() {
 
                     registerRead = registerRead->next;
                 }
+                // meter formulas, registers with the same name take precedence
+                mf = meter->meterFormula;
+                while (mf) {
+                    snprintf(name,sizeof(name),"%s.%s",meter->name,mf->name);
+                    if (formulaVarLookup(name,&m,&f) == &mf->fvalue) {
+                        try {
+                            parser->DefineVar(name,&mf->fvalue);
+                        }
+                        catch (mu::Parser::exception_type& e) {
+                            EPRINTFN("error adding variable %s (%s)",name,e.GetMsg().c_str());
+                            exit(1);
+                        }
+                    }
+                    mf = mf->next;
+                }
             }
             meter = meter->next;
         }
@@ -296,12 +1067,12 @@ mu::Parser * initParser() {
 }
 
 
-// init the global parser and add all local variables
-//mu::Parser *parser
+// init the local parser of a meter and add all local variables, the parser is created once per meter
 mu::Parser * initLocalParser(meter_t *meter) {
     meterRegisterRead_t *registerRead;
     mu::Parser *parser;
 
+    if (meter->localParser) return meter->localParser;
     parser = new (mu::Parser);
     parser-> DefineNameChars(MUPARSER_ALLOWED_CHARS);
     parser->DefineFun(_T("rnd"), Rnd, false);     // Add an unoptimizeable function
@@ -318,59 +1089,373 @@ mu::Parser * initLocalParser(meter_t *meter) {
 
         registerRead = registerRead->next;
     }
+    meter->localParser = parser;
     return parser;
 }
 
 
-void executeMeterFormulas(int verboseMsg, meter_t * meter) {
-    meterFormula_t * mf = meter->meterFormula;
-    mu::Parser *parser = NULL;
-    if (!mf) return;
-    if (verbose > 1)
-		printf("\nexecuteMeterFormulas for \"%s\"\n",meter->name);
-    while(mf) {
-        if (!parser) parser = initParser();
-        try {
-            parser->SetExpr(mf->formula);
-            mf->fvalue = parser->Eval();
-            if (verbose > 1)
-				printf("%s \"%s\" %10.2f\n",mf->name,mf->formula,mf->fvalue);
-        }
-        catch (mu::Parser::exception_type &e) {
-            EPRINTFN("%s.%s error evaluating meter formula (%s)",meter->name,mf->name,e.GetMsg().c_str());
-            exit(1);
-        }
-        mf = mf->next;
+// add the meter or formula providing a variable to the inputs of a formula
+// returns 1 if the formula uses its own previous value
+static int formulaAddInput(meterFormula_t * mf, const char * name) {
+    meter_t *meter;
+    meterFormula_t *input;
+    int i;
+
+    if (formulaVarLookup(name,&meter,&input) == NULL) return 0;
+    if (input) {
+        if (input == mf) return 1;    // previous value of the formula itself
+        for (i=0;i<mf->numInputFormulas;i++) if (mf->inputFormulas[i] == input) return 0;
+        mf->inputFormulas = (meterFormula_t **)realloc(mf->inputFormulas,(mf->numInputFormulas + 1) * sizeof(meterFormula_t *));
+        mf->inputFormulas[mf->numInputFormulas++] = input;
+    } else {
+        for (i=0;i<mf->numInputMeters;i++) if (mf->inputMeters[i] == meter) return 0;
+        mf->inputMeters = (meter_t **)realloc(mf->inputMeters,(mf->numInputMeters + 1) * sizeof(meter_t *));
+        mf->inputMeters[mf->numInputMeters++] = meter;
     }
+    return 0;
 }
 
 
-int executeMeterTypeFormulas(int verboseMsg, meter_t *meter) {
-    meterRegisterRead_t *registerRead;
+// formulas using rnd have to be evaluated on every query
+static int formulaIsVolatile(const char * formula) {
+    const char *p = formula;
 
-    mu::Parser * parser = NULL;
-    registerRead = meter->registerRead;
-    while (registerRead) {
+    while ((p = strstr(p,"rnd")) != NULL) {
+        if ((p == formula || strchr(MUPARSER_ALLOWED_CHARS,*(p-1)) == NULL) && p[3] != 0 && strchr(MUPARSER_ALLOWED_CHARS,p[3]) == NULL) return 1;
+        p += 3;
+    }
+    return 0;
+}
+
+
+// compile a meter formula into a parser of its own, only the variables used by the formula will be bound
+static mu::Parser * compileMeterFormula(meter_t * meter, meterFormula_t * mf) {
+    mu::Parser *formulaParser;
+    mu::varmap_type usedVars;
+    int usesPrevious = 0;
+
+    mf->meter = meter;
+    formulaParser = new (mu::Parser);
+    formulaParser->DefineNameChars(MUPARSER_ALLOWED_CHARS);
+    formulaParser->DefineFun(_T("rnd"), Rnd, false);
+    try {
+        initParser(0)->SetExpr(mf->formula);
+        usedVars = parser->GetUsedVar();
+        mu::varmap_type::const_iterator item = usedVars.begin();
+        for (; item!=usedVars.end(); ++item) {
+            if (item->second == NULL) {
+                EPRINTFN("%s.%s unknown variable %s in meter formula \"%s\"",meter->name,mf->name,item->first.c_str(),mf->formula);
+                exit(1);
+            }
+            formulaParser->DefineVar(item->first,item->second);
+            usesPrevious |= formulaAddInput(mf,item->first.c_str());
+        }
+        formulaParser->SetExpr(mf->formula);
+        formulaParser->Eval();      // creates the bytecode, following calls to Eval will not parse the formula again
+    }
+    catch (mu::Parser::exception_type &e) {
+        EPRINTFN("%s.%s error compiling meter formula \"%s\" (%s)",meter->name,mf->name,mf->formula,e.GetMsg().c_str());
+        exit(1);
+    }
+    // formulas using their previous value (e.g. counters) are evaluated on every query as well
+    mf->isVolatile = usesPrevious || formulaIsVolatile(mf->formula) || (mf->numInputMeters == 0 && mf->numInputFormulas == 0);
+    return formulaParser;
+}
+
+
+// add a formula to formulaOrder after the formulas it depends on
+// returns 1 if the formula is part of a circular reference
+static int formulaSort(meterFormula_t * mf) {
+    meterFormula_t *input;
+    int i;
+
+    if (mf->sortState == 2) return 0;
+    if (mf->sortState == 1) return 1;
+    mf->sortState = 1;
+    i = 0;
+    while (i < mf->numInputFormulas) {
+        input = mf->inputFormulas[i];
+        if (formulaSort(input)) {
+            // circular reference, like a reference to the formula itself the previous value of the input will be used
+            LOGN(0,"Warning: %s.%s circular reference in meter formula \"%s\", the previous value of %s.%s will be used",
+                mf->meter->name,mf->name,mf->formula,input->meter->name,input->name);
+            mf->inputFormulas[i] = mf->inputFormulas[--mf->numInputFormulas];
+            mf->isVolatile = 1;
+            continue;
+        }
+        i++;
+    }
+    mf->sortState = 2;
+    formulaOrder[numFormulaOrder++] = mf;
+    return 0;
+}
+
+
+// compile a meter type formula for a meter, only the registers used by the formula will be bound
+static mu::Parser * compileMeterTypeFormula(meter_t * meter, meterRegisterRead_t * registerRead) {
+    mu::Parser *formulaParser;
+    mu::Parser *localParser;
+    mu::varmap_type usedVars;
+    const char *formula = registerRead->registerDef->formula;
+
+    formulaParser = new (mu::Parser);
+    formulaParser->DefineNameChars(MUPARSER_ALLOWED_CHARS);
+    formulaParser->DefineFun(_T("rnd"), Rnd, false);
+    try {
+        localParser = initLocalParser(meter);
+        localParser->SetExpr(formula);
+        usedVars = localParser->GetUsedVar();
+        mu::varmap_type::const_iterator item = usedVars.begin();
+        for (; item!=usedVars.end(); ++item) {
+            if (item->second == NULL) {
+                EPRINTFN("%s.%s unknown variable %s in meter type formula \"%s\"",meter->name,registerRead->registerDef->name,item->first.c_str(),formula);
+                exit(1);
+            }
+            formulaParser->DefineVar(item->first,item->second);
+        }
+        formulaParser->SetExpr(formula);
+        formulaParser->Eval();      // creates the bytecode
+    }
+    catch (mu::Parser::exception_type &e) {
+        EPRINTFN("%s.%s error compiling meter type formula \"%s\" (%s)",meter->name,registerRead->registerDef->name,formula,e.GetMsg().c_str());
+        exit(1);
+    }
+    return formulaParser;
+}
+
+
+// minimum number of meters of a meter type to evaluate the meter type formulas for all meters in one pass
+#define FORMULA_BULK_MIN 2
+
+// variable factory for the bulk parsers of a meter type, binds a register name to the array of values of this register
+static value_type * bulkVarFactory(const char_type *name, void *userData) {
+    meterType_t *meterType = (meterType_t *)userData;
+    meterRegister_t *meterRegister;
+
+    for (meterRegister = meterType->meterRegisters; meterRegister; meterRegister = meterRegister->next)
+        if (strcmp(meterRegister->name,name) == 0) return &meterType->bulkValues[meterRegister->index * meterType->bulkSize];
+    throw mu::ParserError(std::string("unknown variable ") + name);
+}
+
+
+// compile the formulas of a meter type for the evaluation across all meters of this type
+static void compileMeterTypeBulk(meterType_t *meterType) {
+    meterRegister_t *meterRegister;
+    meter_t *meter;
+    mu::Parser *bulkParser;
+    mu::varmap_type usedVars;
+    int i;
+
+    meterType->numRegisters = 0;
+    meterType->hasFormulas = 0;
+    for (meterRegister = meterType->meterRegisters; meterRegister; meterRegister = meterRegister->next) {
+        meterRegister->index = meterType->numRegisters++;
+        if (meterRegister->formula) meterType->hasFormulas = 1;
+    }
+    meterType->bulkSize = 0;
+    if (!meterType->hasFormulas) return;
+    for (meter = meters; meter; meter = meter->next)
+        if (meter->meterType == meterType && meter->disabled == 0 && meter->isFormulaOnly == 0) meterType->bulkSize++;
+    if (meterType->bulkSize < FORMULA_BULK_MIN) {
+        meterType->bulkSize = 0;
+        return;
+    }
+
+    meterType->bulkRegisters = (meterRegisterRead_t **)calloc(meterType->bulkSize * meterType->numRegisters,sizeof(meterRegisterRead_t *));
+    meterType->bulkValues = (double *)calloc(meterType->bulkSize * meterType->numRegisters,sizeof(double));
+    meterType->bulkResults = (double *)calloc(meterType->bulkSize,sizeof(double));
+    for (meterRegister = meterType->meterRegisters; meterRegister; meterRegister = meterRegister->next) {
+        if (!meterRegister->formula) continue;
+        bulkParser = new (mu::Parser);
+        bulkParser->DefineNameChars(MUPARSER_ALLOWED_CHARS);
+        bulkParser->DefineFun(_T("rnd"), Rnd, false);
+        bulkParser->SetVarFactory(bulkVarFactory, meterType);
+        try {
+            bulkParser->SetExpr(meterRegister->formula);
+            usedVars = bulkParser->GetUsedVar();
+            meterRegister->bulkInputs = (int *)calloc(usedVars.size() + 1,sizeof(int));
+            mu::varmap_type::const_iterator item = usedVars.begin();
+            for (i=0; item!=usedVars.end(); ++item, i++)
+                meterRegister->bulkInputs[i] = (item->second - meterType->bulkValues) / meterType->bulkSize;
+            meterRegister->numBulkInputs = i;
+            bulkParser->Eval();     // creates the bytecode
+        }
+        catch (mu::Parser::exception_type &e) {
+            EPRINTFN("%s.%s error compiling meter type formula \"%s\" (%s)",meterType->name,meterRegister->name,meterRegister->formula,e.GetMsg().c_str());
+            exit(1);
+        }
+        meterRegister->bulkParser = bulkParser;
+    }
+    VPRINTFN(2,"compileFormulas: formulas of meter type %s will be evaluated across %d meters",meterType->name,meterType->bulkSize);
+}
+
+
+// compile the formulas of all meters and sort the meter formulas by dependencies
+void compileFormulas() {
+    meter_t *meter = meters;
+    meterType_t *meterType;
+    meterFormula_t *mf;
+    meterRegisterRead_t *registerRead;
+    int numFormulas = 0;
+
+    if (formulaOrder) return;
+    for (meterType = meterTypes; meterType; meterType = meterType->next)
+        compileMeterTypeBulk(meterType);
+    while (meter) {
+        if (meter->disabled == 0) {
+            // meter type formulas evaluated per meter
+            registerRead = meter->registerRead;
+            while (registerRead && meter->meterType->bulkSize == 0) {
+                if (registerRead->registerDef->formula && !registerRead->parser)
+                    registerRead->parser = compileMeterTypeFormula(meter,registerRead);
+                registerRead = registerRead->next;
+            }
+            mf = meter->meterFormula;
+            while (mf) {
+                if (!mf->parser) mf->parser = compileMeterFormula(meter,mf);
+                numFormulas++;
+                mf = mf->next;
+            }
+        }
+        meter = meter->next;
+    }
+
+    formulaOrder = (meterFormula_t **)calloc(numFormulas + 1,sizeof(meterFormula_t *));
+    meter = meters;
+    while (meter) {
+        if (meter->disabled == 0) {
+            mf = meter->meterFormula;
+            while (mf) {
+                formulaSort(mf);
+                mf = mf->next;
+            }
+        }
+        meter = meter->next;
+    }
+    VPRINTFN(2,"compileFormulas: %d meter formulas",numFormulaOrder);
+}
+
+
+// evaluate the meter formulas of the meters read or of all enabled meters if metersRead is NULL (initial
+// query), formulas are evaluated in the order of their dependencies and only if a meter or formula used has
+// been refreshed since the last evaluation
+void executeMeterFormulas(int verboseMsg, meter_t ** metersRead, int numMetersRead) {
+    meterFormula_t * mf;
+    meter_t *meter;
+    int i,n,evaluate;
+
+    if (!formulaOrder) compileFormulas();
+    formulaSeq++;
+    if (metersRead) {
+        for (i=0;i<numMetersRead;i++)
+            if (metersRead[i]->meterHasBeenRead) metersRead[i]->refreshSeq = formulaSeq;
+    } else {
+        for (meter = meters; meter; meter = meter->next)
+            if (! meter->disabled) meter->refreshSeq = formulaSeq;
+    }
+
+    for (n=0;n<numFormulaOrder;n++) {
+        mf = formulaOrder[n];
+        if (mf->meter->refreshSeq != formulaSeq) continue;     // meter not read in this cycle
+        evaluate = mf->isVolatile || mf->evalSeq == 0;
+        for (i=0;i<mf->numInputMeters && !evaluate;i++)
+            if (mf->inputMeters[i]->refreshSeq > mf->evalSeq) evaluate = 1;
+        for (i=0;i<mf->numInputFormulas && !evaluate;i++)
+            if (mf->inputFormulas[i]->evalSeq > mf->evalSeq) evaluate = 1;
+        if (!evaluate) continue;
+        try {
+            mf->fvalue = mf->parser->Eval();
+            mf->evalSeq = formulaSeq;
+            if (verbose > 1)
+				printf("%s.%s \"%s\" %10.2f\n",mf->meter->name,mf->name,mf->formula,mf->fvalue);
+        }
+        catch (mu::Parser::exception_type &e) {
+            EPRINTFN("%s.%s error evaluating meter formula (%s)",mf->meter->name,mf->name,e.GetMsg().c_str());
+            exit(1);
+        }
+    }
+}
+
+
+int executeMeterTypeFormulas(int verboseMsg, meter_t *meter) {
+    meterRegisterRead_t *registerRead;
+
+    registerRead = meter->registerRead;
+    while (registerRead) {
         // execute formulas
         if (registerRead->registerDef->formula) {
-            if (!parser) parser = initLocalParser(meter);
+            if (!registerRead->parser) registerRead->parser = compileMeterTypeFormula(meter,registerRead);
             try {
-                parser->SetExpr(registerRead->registerDef->formula);
-                registerRead->fvalue = parser->Eval();
+                registerRead->fvalue = registerRead->parser->Eval();
                 applyDevider(registerRead);
                 VPRINTF(2,"MeterType formula for %s: \"%s\" -> %10.2f\n",meter->name,registerRead->registerDef->formula,registerRead->fvalue);
             }
             catch (mu::Parser::exception_type &e) {
-                EPRINTFN("%d.%d error evaluating meter type formula (%s)",meter->name,registerRead->registerDef->name,e.GetMsg().c_str());
+                EPRINTFN("%s.%s error evaluating meter type formula (%s)",meter->name,registerRead->registerDef->name,e.GetMsg().c_str());
             }
         }
 		registerRead = registerRead->next;
 	}
-	if (parser) delete(parser);
     return 0;
 }
 
 
+// evaluate the meter type formulas of the meters read. The formulas of meter types used by multiple meters are
+// evaluated in one pass for all meters of the type, the registers used are gathered into arrays and the
+// results are written back to the registers of the meters
+static void executeMeterTypeFormulasBulk(int verboseMsg, meter_t **metersRead, int numMetersRead) {
+    meterType_t *meterType;
+    meterRegister_t *meterRegister;
+    meterRegisterRead_t *registerRead;
+    meterRegisterRead_t **bulkRegisters;
+    meter_t *meter;
+    double *values;
+    int i,j,k;
+
+    if (!formulaOrder) compileFormulas();
+    for (meterType = meterTypes; meterType; meterType = meterType->next) meterType->numBulk = 0;
+
+    for (i=0;i<numMetersRead;i++) {
+        meter = metersRead[i];
+        if (!meter->meterHasBeenRead || meter->disabled || meter->isFormulaOnly || !meter->meterType->hasFormulas) continue;
+        meterType = meter->meterType;
+        if (meterType->bulkSize == 0) {
+            executeMeterTypeFormulas(verboseMsg,meter);
+            continue;
+        }
+        bulkRegisters = &meterType->bulkRegisters[meterType->numBulk * meterType->numRegisters];
+        for (registerRead = meter->registerRead, k = 0; registerRead; registerRead = registerRead->next, k++) bulkRegisters[k] = registerRead;
+        meterType->numBulk++;
+    }
+
+    for (meterType = meterTypes; meterType; meterType = meterType->next) {
+        if (meterType->numBulk == 0) continue;
+        // formulas in the sequence they have been defined, a formula may use the results of the previous ones
+        for (meterRegister = meterType->meterRegisters; meterRegister; meterRegister = meterRegister->next) {
+            if (!meterRegister->bulkParser) continue;
+            for (i=0;i<meterRegister->numBulkInputs;i++) {
+                k = meterRegister->bulkInputs[i];
+                values = &meterType->bulkValues[k * meterType->bulkSize];
+                for (j=0;j<meterType->numBulk;j++) values[j] = meterType->bulkRegisters[j * meterType->numRegisters + k]->fvalue;
+            }
+            try {
+                meterRegister->bulkParser->Eval(meterType->bulkResults,meterType->numBulk);
+            }
+            catch (mu::Parser::exception_type &e) {
+                EPRINTFN("%s.%s error evaluating meter type formula (%s)",meterType->name,meterRegister->name,e.GetMsg().c_str());
+                continue;
+            }
+            for (j=0;j<meterType->numBulk;j++) {
+                registerRead = meterType->bulkRegisters[j * meterType->numRegisters + meterRegister->index];
+                registerRead->fvalue = meterType->bulkResults[j];
+                applyDevider(registerRead);
+            }
+            VPRINTF(2,"MeterType formula for %d meters of type %s: \"%s\"\n",meterType->numBulk,meterType->name,meterRegister->formula);
+        }
+    }
+}
+
+
 
 void listConstants(mu::Parser *parser) {
     mu::valmap_type cmap = parser->GetConst();
@@ -452,7 +1537,6 @@ void evalFormula(const char * welcome, const char * prompt) {
     char *line;
     double result;
     //printf(prompt); printf("\n");
-    initParser();
     printf(evalHelp);
 
     rl_attempted_completion_function = character_name_completion;
@@ -552,19 +1636,63 @@ void testRegCalcFormula(char * meterName) {
         printf("\nFormula test for calculating virtual registers in a meter definition\n");
         prompt = (char *)malloc(strlen(PROMPT)+1);
         strcpy(prompt,PROMPT);
-        parser = initParser();
+        parser = initParser(1);
     }
     currParser = parser;    // for auto complete n readline
 
     evalFormula("Formula test for register values",prompt);
     free(prompt);
-    delete(parser);
 }
 
 
 void freeFormulaParser() {
+	meter_t *meter = meters;
+	meterType_t *meterType;
+	meterRegister_t *meterRegister;
+	meterFormula_t *mf;
+	meterRegisterRead_t *registerRead;
+
 	if (parser) delete(parser);
 	parser = NULL;
+	while (meter) {
+		registerRead = meter->registerRead;
+		while (registerRead) {
+			if (registerRead->parser) delete(registerRead->parser);
+			registerRead->parser = NULL;
+			registerRead = registerRead->next;
+		}
+		if (meter->localParser) delete(meter->localParser);
+		meter->localParser = NULL;
+		mf = meter->meterFormula;
+		while (mf) {
+			if (mf->parser) delete(mf->parser);
+			mf->parser = NULL;
+			free(mf->inputMeters);
+			free(mf->inputFormulas);
+			mf->inputMeters = NULL; mf->inputFormulas = NULL;
+			mf->numInputMeters = 0; mf->numInputFormulas = 0;
+			mf->sortState = 0;
+			mf = mf->next;
+		}
+		meter = meter->next;
+	}
+	for (meterType = meterTypes; meterType; meterType = meterType->next) {
+		for (meterRegister = meterType->meterRegisters; meterRegister; meterRegister = meterRegister->next) {
+			if (meterRegister->bulkParser) delete(meterRegister->bulkParser);
+			meterRegister->bulkParser = NULL;
+			free(meterRegister->bulkInputs);
+			meterRegister->bulkInputs = NULL;
+			meterRegister->numBulkInputs = 0;
+		}
+		free(meterType->bulkRegisters);
+		free(meterType->bulkValues);
+		free(meterType->bulkResults);
+		meterType->bulkRegisters = NULL; meterType->bulkValues = NULL; meterType->bulkResults = NULL;
+		meterType->bulkSize = 0; meterType->numBulk = 0;
+	}
+	free(formulaOrder);
+	formulaOrder = NULL;
+	numFormulaOrder = 0;
 }
 
 
@@ -766,26 +1894,26 @@ const char * mbus_data_record_type(mbus_data_record *record) {
 }
 
 
-void setRegisterValue(meter_t * meter,int recordNumber,const char * value, float fvalue) {
+// the register for a record number, NULL if the record is not used by the meter type
+static inline meterRegisterRead_t * recordRegister(meter_t * meter,int recordNumber) {
+	if (recordNumber < 0 || recordNumber > meter->maxRecordNumber) return NULL;
+	return meter->recordRegister[recordNumber];
+}
+
+
+void setRegisterValue(meter_t * meter,int recordNumber,const char * value, double fvalue) {
     meterRegisterRead_t *rr;
     char *endptr;
-    if (meter)
-        if (meter->registerRead) {
-            rr = meter->registerRead;
-            while (rr) {
-                if (rr->registerDef->recordNumber == recordNumber) {
-                    if (value) {
-						rr->fvalue = strtod(value,&endptr);
-						if (*endptr != 0) EPRINTFN("%s.%s: unable to convert value '%s' to a number",meter->name,rr->registerDef->name,value);
-					}  else rr->fvalue = fvalue;
-					//VPRINTF(9,"%s %d '%s' %6.3f %6.3f ",meter->name,recordNumber,value,fvalue,rr->fvalue);
-                    applyDevider (rr);
-                    //VPRINTF(9,"%6.3f\n",rr->fvalue);
-                    return;
-                }
-                rr = rr->next;
-            }
+    if (meter) {
+        rr = recordRegister(meter,recordNumber);
+        if (rr) {
+            if (value) {
+                rr->fvalue = strtod(value,&endptr);
+                if (*endptr != 0) EPRINTFN("%s.%s: unable to convert value '%s' to a number",meter->name,rr->registerDef->name,value);
+            }  else rr->fvalue = fvalue;
+            applyDevider (rr);
         }
+    }
 }
 
 
@@ -823,40 +1951,116 @@ int process_mbus_data_fixed(meter_t * meter, mbus_data_fixed *data, int verboseM
 }
 
 
-int process_mbus_data_variable(meter_t * meter, mbus_data_variable *data, int verboseMsg) {
-    mbus_data_record *record;
-    int i,tariff;
-    char *unit = NULL;
-    char *func = NULL;
-    char *value = NULL;
-    char *medium = NULL;
-    char *manufacturer = NULL;
+// decode numeric records directly, same value as mbus_data_record_value would return but without
+// the string round trip. The VIF exponent is not applied (use div/mul in the meter type)
+// returns 0 if the record has been decoded, -1 for records that are not numeric (date/time, strings, binary)
+static int mbus_data_record_numeric(mbus_data_record *record, double *fvalue) {
+	unsigned char vif, vife;
+	int int_val,dateTime;
+	long long long_long_val;
+	int len,n;
+
+	vif = (record->drh.vib.vif & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+	vife = (record->drh.vib.vife[0] & MBUS_DIB_VIF_WITHOUT_EXTENSION);
+	dateTime = (vif == 0x6D) || ((record->drh.vib.vif == 0xFD) && ((vife == 0x30) || (vife == 0x70)));
+
+	switch (record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA) {
+		case 0x00:	// no data
+			*fvalue = 0;
+			return 0;
+		case 0x01:	// 8 bit integer
+		case 0x03:	// 24 bit integer
+			len = record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA;
+			if (mbus_data_int_decode(record->data, len, &int_val) != 0) return -1;
+			*fvalue = int_val;
+			return 0;
+		case 0x02:	// 16 bit integer or date
+			if (vif == 0x6C) return -1;
+			if (mbus_data_int_decode(record->data, 2, &int_val) != 0) return -1;
+			*fvalue = int_val;
+			return 0;
+		case 0x04:	// 32 bit integer or date/time
+			if (dateTime) return -1;
+			if (mbus_data_int_decode(record->data, 4, &int_val) != 0) return -1;
+			*fvalue = int_val;
+			return 0;
+		case 0x05:	// 32 bit real
+			*fvalue = mbus_data_float_decode(record->data);
+			return 0;
+		case 0x06:	// 48 bit integer or date/time
+		case 0x07:	// 64 bit integer
+			if ((record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA) == 0x06) {
+				if (dateTime) return -1;
+				len = 6;
+			} else len = 8;
+			if (mbus_data_long_long_decode(record->data, len, &long_long_val) != 0) return -1;
+			*fvalue = long_long_val;
+			return 0;
+		case 0x09:	// 2 digit BCD
+		case 0x0A:	// 4 digit BCD
+		case 0x0B:	// 6 digit BCD
+		case 0x0C:	// 8 digit BCD
+		case 0x0E:	// 12 digit BCD
+			n = record->drh.dib.dif & MBUS_DATA_RECORD_DIF_MASK_DATA;
+			len = (n == 0x0E) ? 6 : n - 8;
+			// non decimal digits (e.g. sign or error indication) are handled by the string path
+			for (n = 0; n < len; n++)
+				if ((record->data[n] & 0x0F) > 9 || (record->data[n] >> 4) > 9) return -1;
+			*fvalue = mbus_data_bcd_decode(record->data, len);
+			return 0;
+	}
+	return -1;
+}
+
 
-    medium = strdup(mbus_data_variable_medium_lookup(data->header.medium));
-    manufacturer = strdup(mbus_decode_manufacturer(data->header.manufacturer[0], data->header.manufacturer[1]));
+// records of a multi telegram response are numbered consecutively, recordNumber is the number of the first record
+// recordMap (optional) receives the record number assigned to each record of the telegram
+int process_mbus_data_variable(meter_t * meter, mbus_data_variable *data, int verboseMsg, int *recordNumber, int *recordMap) {
+    mbus_data_record *record;
+    int i;
+    int map[MBUS_FRAME_DATA_LENGTH / 2];
+    int useMap = 0;
+    int rn;
+    double fvalue;
+
+    if (meter->selState == SEL_ACTIVE) {
+        if (mbusSel_map(meter,data,map,sizeof(map)/sizeof(map[0])) == 0) useMap = 1;
+        else {
+            mbusSel_failed(meter);
+            // not a full readout, the records can not be assigned by their number
+            for (record = data->record, i = 0; record; record = (mbus_data_record *)record->next) i++;
+            if (*recordNumber > 0 || i <= meter->maxRecordNumber) return -2;
+        }
+    }
+    if (meter->selState == SEL_LEARN) mbusSel_learn(meter,data,*recordNumber);
 
-    if (verbose > 2) printf("%s (manufacturer: %s, version: %d, status: %d, medium: %s, access: %d)\n",meter->name,manufacturer,data->header.version,data->header.status,medium,data->header.access_no);
+    // strings are only needed for verbose output, the libmbus functions return thread local buffers
+    if (verbose > 2) {
+        printf("%s (manufacturer: %s, ",meter->name,mbus_decode_manufacturer(data->header.manufacturer[0], data->header.manufacturer[1]));
+        printf("version: %d, status: %d, medium: %s, access: %d)\n",data->header.version,data->header.status,mbus_data_variable_medium_lookup(data->header.medium),data->header.access_no);
+    }
 
-    for (record = data->record, i = 0; record; record = (mbus_data_record *)record->next, i++) {
-        free(unit); unit = NULL;
-        free(func); func = NULL;
-        free(value); value = NULL;
-        tariff = 0;
+    for (record = data->record, i = *recordNumber; record; record = (mbus_data_record *)record->next, i++) {
+        rn = useMap ? map[i - *recordNumber] : i;
+        if (recordMap) recordMap[i - *recordNumber] = rn;
         if (record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) { // MBUS_DIB_DIF_VENDOR_SPECIFIC
             LOGN(4,"%s: MBUS_DIB_DIF_VENDOR_SPECIFIC, record id %d ignored",meter->name,i);
         }
         else if (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW) {
-            LOGN(3,"%s: MBUS_DIB_DIF_MORE_RECORDS_FOLLOW not yet implemented",meter->name);
-        } else {
-            func = strdup(mbus_data_record_function(record));
-            unit = strdup(mbus_vib_unit_lookup(&(record->drh.vib)));
-            tariff = mbus_data_record_tariff(record);
+            LOGN(4,"%s: MBUS_DIB_DIF_MORE_RECORDS_FOLLOW, record id %d",meter->name,i);
+        }
+        if (verbose > 2) {
+            if ((record->drh.dib.dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC) || (record->drh.dib.dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW))
+                printf(" Record %d, value: %s, type: %s, unit: (null), function: (null), tariff: 0\n",rn,mbus_data_record_value(record),mbus_data_record_type(record));
+            else
+                printf(" Record %d, value: %s, type: %s, unit: %s, function: %s, tariff: %ld\n",rn,mbus_data_record_value(record),mbus_data_record_type(record),
+                       mbus_vib_unit_lookup(&(record->drh.vib)),mbus_data_record_function(record),mbus_data_record_tariff(record));
         }
-        value = strdup(mbus_data_record_value(record));
-        if (verbose > 2) printf(" Record %d, value: %s, type: %s, unit: %s, function: %s, tariff: %d\n",i,value,mbus_data_record_type(record),unit,func,tariff);
-        setRegisterValue(meter,i,value,0);
+        if (! recordRegister(meter,rn)) continue;	// not used, no need to decode
+        if (mbus_data_record_numeric(record,&fvalue) == 0) setRegisterValue(meter,rn,NULL,fvalue);
+        else setRegisterValue(meter,rn,mbus_data_record_value(record),0);
     }
-    free(unit); free(func); free(value); free(medium); free(manufacturer);
+    *recordNumber = i;
     return 0;
 }
 
@@ -894,17 +2098,305 @@ int mbusSelectSlave (mbus_handle *mb, int verbose, uint64_t * mbusAddress) {
 
 
 
-#define RETRY_COUNT 2
-#define RETRY_DELAY 15000
+// send REQ_UD2 (FCV set) with the given frame count bit
+static int mbusMeter_sendRequest(meter_t *meter, int fcb) {
+	mbus_frame *frame;
+	int res;
+
+	frame = mbus_frame_new(MBUS_FRAME_TYPE_SHORT);
+	if (frame == NULL) return -1;
+	frame->control = MBUS_CONTROL_MASK_REQ_UD2 | MBUS_CONTROL_MASK_DIR_M2S | (fcb ? MBUS_CONTROL_MASK_FCB : 0);
+	frame->address = meter->mbusAddress;
+	res = mbus_send_frame(*meter->mb, frame);
+	mbus_frame_free(frame);
+	return res;
+}
+
+
+// SND_NKE, restarts a multi telegram response with the first telegram. For secondary addressing
+// this deselects the meter as well
+static int mbusMeter_reset(meter_t *meter) {
+	uint64_t telegramStart;
+
+	if (meter->secondaryAddr && meter->bus) meter->bus->selected[0] = 0;
+	if (! meter->isTCP) mbusBus_waitGap(meter);
+	telegramStart = getMonotonicMs();
+	if (mbus_send_ping_frame(*meter->mb, meter->mbusAddress, 0) != 0) {
+		EPRINTFN("%s: failed to send SND_NKE",meter->name);
+		return -1;
+	}
+	if (mbusMeter_recvAck(meter,telegramStart) != 0) {
+		EPRINTFN("%s: no acknowledge for SND_NKE",meter->name);
+		return -1;
+	}
+	return 0;
+}
+
+
+// query and decode one telegram, moreRecords will be set if the meter has more telegrams
+#define LAYOUT_RECORDS_MAX (MBUS_FRAME_DATA_LENGTH / 2)
+
+static meterLayout_t * mbusLayout_find(meter_t *meter, int firstRecord) {
+	meterLayout_t *l = meter->layouts;
+
+	while (l) {
+		if (l->firstRecord == firstRecord) return l;
+		l = l->next;
+	}
+	return NULL;
+}
+
+
+// the telegram has the same layout if all header bytes are unchanged, only data bytes may differ
+static int mbusLayout_matches(meterLayout_t *l, meter_t *meter, mbus_frame *frame) {
+	size_t i;
+
+	if (!l) return 0;
+	if (l->numRecords < 0 || l->selState != meter->selState) return 0;
+	if (frame->control_information != MBUS_CONTROL_INFO_RESP_VARIABLE || frame->data_size != l->dataSize) return 0;
+	for (i = 0; i < l->dataSize; i++)
+		if (l->mask[i] && frame->data[i] != l->data[i]) return 0;
+	return 1;
+}
+
+
+// mark the header bytes and get the data offsets of the records, same logic as mbus_data_variable_parse
+// returns the number of records or -1 on error
+static int mbusLayout_scan(const unsigned char *d, size_t size, unsigned char *mask, int *offsets, int maxRecords) {
+	size_t i = MBUS_DATA_VARIABLE_HEADER_LENGTH;
+	int numRecords = 0;
+	size_t len;
+	unsigned char dif,vif;
+
+	if (size < i) return -1;
+	memset(mask,0,size);
+	memset(mask,1,8);		// ident, manufacturer, version, medium
+	while (i < size) {
+		if (d[i] == MBUS_DIB_DIF_IDLE_FILLER) {
+			mask[i++] = 1;
+			continue;
+		}
+		if (numRecords >= maxRecords) return -1;
+		dif = d[i]; mask[i] = 1;
+		if (dif == MBUS_DIB_DIF_MANUFACTURER_SPECIFIC || dif == MBUS_DIB_DIF_MORE_RECORDS_FOLLOW) {
+			offsets[numRecords++] = ++i;
+			break;		// remaining data is vendor specific
+		}
+		len = mbus_dif_datalength_lookup(dif);
+		while (i < size && (d[i] & MBUS_DIB_DIF_EXTENSION_BIT)) {
+			if (i+1 < size) mask[i+1] = 1;
+			i++;
+		}
+		i++;
+		if (i >= size) return -1;
+		vif = d[i]; mask[i++] = 1;
+		if ((vif & MBUS_DIB_VIF_WITHOUT_EXTENSION) == 0x7C) {	// variable length VIF in ASCII format
+			if (i >= size || i + d[i] + 1 > size) return -1;
+			memset(mask+i,1,d[i] + 1);
+			i += d[i] + 1;
+		}
+		if (vif & MBUS_DIB_VIF_EXTENSION_BIT) {
+			if (i >= size) return -1;
+			mask[i] = 1;
+			while (i < size && (d[i] & MBUS_DIB_VIF_EXTENSION_BIT)) {
+				if (i+1 < size) mask[i+1] = 1;
+				i++;
+			}
+			i++;
+		}
+		if (i > size) return -1;
+		if ((dif & MBUS_DATA_RECORD_DIF_MASK_DATA) == 0x0D) {
+			if (i >= size) return -1;
+			mask[i] = 1;
+			if (d[i] <= 0xBF) len = d[i];
+			else if (d[i] <= 0xCF) len = (d[i] - 0xC0) * 2;
+			else if (d[i] <= 0xDF) len = (d[i] - 0xD0) * 2;
+			else if (d[i] <= 0xEF) len = d[i] - 0xE0;
+			else if (d[i] <= 0xFA) len = d[i] - 0xF0;
+			else return -1;
+			i++;
+		}
+		if (i + len > size) return -1;
+		offsets[numRecords++] = i;
+		i += len;
+	}
+	return numRecords;
+}
+
+
+// save the layout of a telegram that has been parsed and processed successfully
+static void mbusLayout_save(meter_t *meter, int firstRecord, mbus_frame *frame, mbus_data_variable *data, int *recordMap) {
+	meterLayout_t *l;
+	mbus_data_record *record;
+	int offsets[LAYOUT_RECORDS_MAX];
+	int i,numUsed;
+
+	if (frame->control_information != MBUS_CONTROL_INFO_RESP_VARIABLE) return;
+	l = mbusLayout_find(meter,firstRecord);
+	if (!l) {
+		l = (meterLayout_t *)calloc(1,sizeof(meterLayout_t));
+		l->firstRecord = firstRecord;
+		l->next = meter->layouts;
+		meter->layouts = l;
+	}
+	if (l->dataSize != frame->data_size || !l->data) {
+		free(l->data); free(l->mask);
+		l->data = (unsigned char *)malloc(frame->data_size);
+		l->mask = (unsigned char *)malloc(frame->data_size);
+	}
+	l->dataSize = frame->data_size;
+	memcpy(l->data,frame->data,frame->data_size);
+	l->selState = meter->selState;
+	l->moreRecords = data->more_records_follow;
+	l->numUsed = 0;
+	l->numRecords = mbusLayout_scan(frame->data,frame->data_size,l->mask,offsets,LAYOUT_RECORDS_MAX);
+	if (l->numRecords != (int)data->nrecords) {
+		VPRINTFN(4,"%s: unable to cache the telegram layout",meter->name);
+		l->numRecords = -1;
+		return;
+	}
+
+	for (record = data->record, i = 0, numUsed = 0; record; record = (mbus_data_record *)record->next, i++)
+		if (recordRegister(meter,recordMap[i])) numUsed++;
+	free(l->records);
+	l->records = (meterLayoutRecord_t *)calloc(numUsed ? numUsed : 1,sizeof(meterLayoutRecord_t));
+	for (record = data->record, i = 0; record; record = (mbus_data_record *)record->next, i++) {
+		if (! recordRegister(meter,recordMap[i])) continue;
+		if (memcmp(record->data,frame->data + offsets[i],record->data_len) != 0) {
+			VPRINTFN(4,"%s: unable to cache the telegram layout, data of record %d differs",meter->name,recordMap[i]);
+			l->numRecords = -1;
+			return;
+		}
+		l->records[l->numUsed].recordNumber = recordMap[i];
+		l->records[l->numUsed].offset = offsets[i];
+		l->records[l->numUsed].record = *record;
+		l->records[l->numUsed].record.next = NULL;
+		l->numUsed++;
+	}
+	VPRINTFN(4,"%s: telegram layout cached, %d records, %d used",meter->name,l->numRecords,l->numUsed);
+}
+
+
+// decode the used records from the cached offsets
+static void mbusLayout_decode(meter_t *meter, meterLayout_t *l, mbus_frame *frame) {
+	meterLayoutRecord_t *r;
+	double fvalue;
+	int i;
+
+	for (i = 0; i < l->numUsed; i++) {
+		r = &l->records[i];
+		memcpy(r->record.data,frame->data + r->offset,r->record.data_len);
+		if (mbus_data_record_numeric(&r->record,&fvalue) == 0) setRegisterValue(meter,r->recordNumber,NULL,fvalue);
+		else setRegisterValue(meter,r->recordNumber,mbus_data_record_value(&r->record),0);
+	}
+}
+
+
+static int queryMeter_telegram(int verboseMsg, meter_t *meter, int fcb, int *recordNumber, int *moreRecords) {
+	mbus_frame reply;
+	mbus_frame_data reply_data;
+	uint64_t telegramStart;
+	int i,res;
+
+	*moreRecords = 0;
+	if (! meter->isTCP) mbusBus_waitGap(meter);
+	telegramStart = getMonotonicMs();
+	res = mbusMeter_sendRequest(meter,fcb);
+	if (res == -1) {
+		EPRINTFN("Failed to send M-Bus request frame for meter %s @ address %d",meter->name,meter->mbusAddress);
+		meter->numErrs++;
+		return -1;
+	}
+
+	res = mbus_recv_frame(*meter->mb, &reply);
+	mbusBus_telegramDone(meter,telegramStart,res);
+	if (res == MBUS_RECV_RESULT_INVALID && ! meter->isTCP) mbus_purge_frames(*meter->mb);	// collision
+	if (res != MBUS_RECV_RESULT_OK) {
+		EPRINTFN("Failed to receive M-Bus response frame for meter %s @ address %d",meter->name,meter->mbusAddress);
+		if (meter->secondaryAddr && meter->bus) meter->bus->selected[0] = 0;	// may have lost the selection
+		if (! meter->isTCP && meter->curBaud) mbusMeter_setCurBaud(meter,0);	// may have been reset to the base rate
+		meter->numErrs++;
+		return -1;
+	}
+
+	if (! meter->isTCP && meter->switchBaud) mbusBaud_confirm(meter);
+
+	// decoding is done in the threads querying the buses, libmbus uses thread local buffers
+
+	// same layout as the last time, no need to parse the record headers
+	if (verbose <= 2 && (meter->selState == SEL_OFF || meter->selState == SEL_ACTIVE)) {
+		meterLayout_t *layout = mbusLayout_find(meter,*recordNumber);
+		if (mbusLayout_matches(layout,meter,&reply)) {
+			if (meter->selState == SEL_ACTIVE)
+				for (i = 0; i < layout->numUsed; i++) mbusSel_setFound(meter,layout->records[i].recordNumber);
+			mbusLayout_decode(meter,layout,&reply);
+			*recordNumber += layout->numRecords;
+			*moreRecords = layout->moreRecords;
+			if (meter->bus) meter->bus->numCached++;
+			return 0;
+		}
+	}
+
+	if (mbus_frame_data_parse(&reply, &reply_data) == -1) {
+		EPRINTFN("M-bus data parse error on meter %s @ %d: %s",meter->name,meter->mbusAddress,mbus_error_str());
+		meter->numErrs++;
+		return -1;
+	}
+
+   	if (reply.type == MBUS_DATA_TYPE_ERROR) {
+		EPRINTFN("mbus_frame_data_parse returned MBUS_DATA_TYPE_ERROR, meter %s @ %d: %s",meter->name,meter->mbusAddress);
+		meter->numErrs++;
+        return -1;
+	}
+
+    // process
+
+	if (reply_data.type == MBUS_DATA_TYPE_FIXED) {
+		res = process_mbus_data_fixed(meter, &(reply_data.data_fix),verboseMsg);
+		if (res) {
+			meter->numErrs++;
+			EPRINTFN("%s: process_mbus_data_fixed failed %d",meter->name,res);
+			return res;
+		}
+	} else
+	if (reply_data.type == MBUS_DATA_TYPE_VARIABLE) {
+		if (meter->secondaryAddr && ! mbus_secondaryMatches(meter->secondaryAddr,&reply_data.data_var.header)) {
+			if (reply_data.data_var.record) mbus_data_record_free(reply_data.data_var.record);
+			if (meter->bus) meter->bus->selected[0] = 0;
+			meter->numErrs++;
+			EPRINTFN("%s: response is not from the device with secondary address %s",meter->name,meter->secondaryAddr);
+			return -1;
+		}
+		int firstRecord = *recordNumber;
+		int selState = meter->selState;
+		int recordMap[LAYOUT_RECORDS_MAX];
+		res = process_mbus_data_variable(meter, &(reply_data.data_var),verboseMsg,recordNumber,recordMap);
+		*moreRecords = reply_data.data_var.more_records_follow;
+		if (res) {
+			if (reply_data.data_var.record) mbus_data_record_free(reply_data.data_var.record);
+			meter->numErrs++;
+			EPRINTFN("%s: process_mbus_data_variable failed %d",meter->name,res);
+			return res;
+		}
+		if (meter->selState == selState && (selState == SEL_OFF || selState == SEL_ACTIVE))
+			mbusLayout_save(meter,firstRecord,&reply,&(reply_data.data_var),recordMap);
+	} else {
+		EPRINTFN("unknown data type in returned data, meter %s @ %d: %s",meter->name,meter->mbusAddress);
+		meter->numErrs++;
+        return -1;
+	}
+
+	if (reply_data.data_var.record)
+		mbus_data_record_free(reply_data.data_var.record); // free's up the whole list
+	return 0;
+}
+
 
 int queryMeter(int verboseMsg, meter_t *meter) {
 	meterRegisterRead_t *meterRegisterRead;
 	int res;
-	char format[50];
-	mbus_frame reply;
-	mbus_frame_data reply_data;
 	struct timespec timeStart, timeEnd;
-	int retryCount;
+	int recordNumber,telegram,fcb,moreRecords;
 
 	if (meter->disabled) return 0;
 	if (meter->isFormulaOnly) {
@@ -931,7 +2423,7 @@ int queryMeter(int verboseMsg, meter_t *meter) {
 			meter->numErrs++;
 			return -555;
 		}
-	} else msleep(250);
+	}
 
 
 	// reset read flags
@@ -947,136 +2439,360 @@ int queryMeter(int verboseMsg, meter_t *meter) {
 	assert (meter->mb != NULL);
 	assert (*meter->mb != NULL);
 
-	// TODO: ping needed ?
-	// TOTO: change to mbus_sendrecv_request to handle more than one reply frame
-
-	retryCount = RETRY_COUNT;
-	do {
-		res = mbus_send_request_frame(*meter->mb, meter->mbusAddress);
-		if (res == -1) {
-			EPRINTFN("Failed to send M-Bus request frame for meter %s @ address %d",meter->name,meter->mbusAddress);
-			meter->numErrs++;
-			return -1;
+	// a failed query will be retried by the caller (see cron_queryMeters)
+	for (;;) {
+		if (! meter->isTCP)
+			if (mbusSerial_setBaud(meter->mb,mbusMeter_curBaud(meter)) != 0) {
+				meter->numErrs++;
+				return -1;
+			}
+		if (meter->multiTelegram)
+			if (mbusMeter_reset(meter) != 0) {
+				meter->numErrs++;
+				return -1;
+			}
+		if (meter->secondaryAddr)
+			if (mbusBus_select(meter) != 0) {
+				meter->numErrs++;
+				return -1;
+			}
+		if (! meter->isTCP && meter->switchBaud && mbusMeter_curBaud(meter) != meter->switchBaud) {
+			mbusMeter_switchBaud(meter);
+			mbusSerial_setBaud(meter->mb,mbusMeter_curBaud(meter));
 		}
-
-		res = mbus_recv_frame(*meter->mb, &reply);
-		if (res != MBUS_RECV_RESULT_OK) {
-			// dont show the first retry
-			EPRINTFN("Failed to receive M-Bus response frame for meter %s @ address %d, retrying",meter->name,meter->mbusAddress);
+		fcb = 1;		// expected by the meter after SND_NKE, toggled with each telegram
+		// SND_NKE resets the data selection of multi telegram meters, send it again
+		if (meter->multiTelegram && meter->selState == SEL_ACTIVE) meter->selState = SEL_SEND;
+		if (meter->selState == SEL_SEND || meter->selState == SEL_RESET)
+			if (mbusSel_send(meter,meter->multiTelegram ? fcb : 0) == 0 && meter->multiTelegram) fcb = ! fcb;
+		if (meter->selState == SEL_ACTIVE) memset(meter->selFound,0,meter->numSelRecords);
+		recordNumber = 0;
+		telegram = 0;
+		do {
+			res = queryMeter_telegram(verboseMsg,meter,meter->multiTelegram ? fcb : 0,&recordNumber,&moreRecords);
+			if (res) return res;
+			fcb = ! fcb;
+			telegram++;
+			// stop as soon as all records used by the meter type have been received
+			if (moreRecords && recordNumber > meter->maxRecordNumber) {
+				VPRINTFN(3,"%s: all required records received after %d telegram(s)",meter->name,telegram);
+				moreRecords = 0;
+			}
+		} while (moreRecords && meter->multiTelegram && telegram < MBUS_TELEGRAMS_MAX);
+		if (moreRecords && ! meter->multiTelegram) {
+			// the meter did not get a SND_NKE before, start over to get defined FCB handling
+			VPRINTFN(1,"%s: more records follow, using multi telegram readout",meter->name);
+			meter->multiTelegram = 1;
+			continue;
+		}
+		break;
+	}
+	if (meter->selState == SEL_LEARN) mbusSel_learnDone(meter);
+	if (meter->selState == SEL_ACTIVE) {
+		if (! mbusSel_complete(meter)) {
+			EPRINTFN("%s: not all selected records received",meter->name);
+			mbusSel_failed(meter);
 			meter->numErrs++;
-			//return -1;
-			msleep(RETRY_DELAY);
+			return -2;
 		}
-		retryCount--;
-	} while ((res != MBUS_RECV_RESULT_OK) && (retryCount > 0));
+		meter->selResponses++;
+	}
 
-	if (res != MBUS_RECV_RESULT_OK) {
-		EPRINTFN("%s: unable to connect after %d retries",meter->name,RETRY_COUNT);
+	clock_gettime(CLOCK_REALTIME,&timeEnd);
+	meter->queryTimeNano = ((timeEnd.tv_sec - timeStart.tv_sec) * NANO_PER_SEC) + (timeEnd.tv_nsec - timeStart.tv_nsec);
+
+	// mark complete
+	meter->meterHasBeenRead = 1;
+	return 0;
+}
+
+
+//*****************************************************************************
+// parallel query of all buses
+
+int pollThreads;		// max number of threads, 0 = one per bus
+
+static pthread_mutex_t pollMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pollStartCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pollDoneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t *pollThreadIds;
+static int numPollThreads;
+static int pollGeneration;		// incremented for every cycle
+static int pollTerminate;
+static int pollVerbose;
+static int pollBusesPending;	// buses with due meters not yet completely queried
+static meterBus_t *pollNextBus;	// next bus to be picked by a worker
+
+
+// query all due meters of one bus, one after another
+// order of secondary addressed meters on a bus: primary addressed meters first (they do not change the
+// selection), then the meter still selected, then the others with the same address next to each other
+static int queryBus_selectOrder(meterBus_t *bus, meter_t *a, meter_t *b) {
+	int ka,kb;
+
+	ka = a->secondaryAddr == NULL ? 0 : strcmp(a->secondaryAddr,bus->selected) == 0 ? 1 : 2;
+	kb = b->secondaryAddr == NULL ? 0 : strcmp(b->secondaryAddr,bus->selected) == 0 ? 1 : 2;
+	if (ka != kb) return ka - kb;
+	if (ka == 2) return strcmp(a->secondaryAddr,b->secondaryAddr);
+	return 0;
+}
+
+
+static void queryBus(int verboseMsg, meterBus_t *bus) {
+	meter_t *meter;
+	int i,j,res;
+	uint64_t queryStart;
+	int queryMs;
+
+	// stable insertion sort, the number of due meters per bus is small
+	for (i=1;i<bus->numDue;i++) {
+		meter = bus->due[i];
+		for (j=i;j>0 && queryBus_selectOrder(bus,meter,bus->due[j-1]) < 0;j--) bus->due[j] = bus->due[j-1];
+		bus->due[j] = meter;
 	}
 
-	if (mbus_frame_data_parse(&reply, &reply_data) == -1) {
-		EPRINTFN("M-bus data parse error on meter %s @ %d: %s",meter->name,meter->mbusAddress,mbus_error_str());
-		meter->numErrs++;
-		return -1;
+	bus->numMetersRead = 0;
+	for (i=0;i<bus->numDue;i++) {
+		meter = bus->due[i];
+		queryStart = getMonotonicMs();
+		res = queryMeter(verboseMsg,meter);
+		queryMs = getMonotonicMs() - queryStart;
+		meter->queryMsAvg = meter->queryMsAvg ? (meter->queryMsAvg * 3 + queryMs) / 4 : queryMs;
+		if (res != 0) {
+			EPRINTFN("%s: query failed",meter->name);
+		} else {
+			bus->numMetersRead++;
+		}
 	}
+}
 
-   	if (reply.type == MBUS_DATA_TYPE_ERROR) {
-		EPRINTFN("mbus_frame_data_parse returned MBUS_DATA_TYPE_ERROR, meter %s @ %d: %s",meter->name,meter->mbusAddress);
-		meter->numErrs++;
-        return -1;
+
+// get the next bus with due meters, pollMutex has to be locked
+static meterBus_t * pollGetNextBus() {
+	meterBus_t *bus;
+
+	while (pollNextBus) {
+		bus = pollNextBus;
+		pollNextBus = bus->next;
+		if (bus->numDue) return bus;
 	}
+	return NULL;
+}
 
-    // process
 
-	if (reply_data.type == MBUS_DATA_TYPE_FIXED) {
-		res = process_mbus_data_fixed(meter, &(reply_data.data_fix),verboseMsg);
-		if (res) {
-			meter->numErrs++;
-			EPRINTFN("%s: process_mbus_data_fixed failed %d",meter->name,res);
-			return res;
+static void * pollWorker(void *arg) {
+	int generation = 0;
+	meterBus_t *bus;
+
+	pthread_mutex_lock(&pollMutex);
+	while (1) {
+		while (generation == pollGeneration && !pollTerminate)
+			pthread_cond_wait(&pollStartCond,&pollMutex);
+		if (pollTerminate) break;
+		generation = pollGeneration;
+		while ((bus = pollGetNextBus()) != NULL) {
+			pthread_mutex_unlock(&pollMutex);
+			queryBus(pollVerbose,bus);
+			pthread_mutex_lock(&pollMutex);
+			pollBusesPending--;
+			if (pollBusesPending == 0) pthread_cond_signal(&pollDoneCond);
 		}
-	} else
-	if (reply_data.type == MBUS_DATA_TYPE_VARIABLE) {
-		res = process_mbus_data_variable(meter, &(reply_data.data_var),verboseMsg);
-		if (res) {
-			meter->numErrs++;
-			EPRINTFN("%s: process_mbus_data_variable failed %d",meter->name,res);
-			return res;
+	}
+	pthread_mutex_unlock(&pollMutex);
+	mbusRecord_freePool();
+	return NULL;
+}
+
+
+static void mbusPoll_startThreads(int numBuses) {
+	int i;
+
+	sigset_t sigAll, sigSaved;
+
+	numPollThreads = numBuses;
+	if (pollThreads > 0 && pollThreads < numBuses) numPollThreads = pollThreads;
+	pollThreadIds = (pthread_t *)calloc(numPollThreads,sizeof(pthread_t));
+	// signals have to be handled by the main thread to wake up the main loop
+	sigfillset(&sigAll);
+	pthread_sigmask(SIG_BLOCK,&sigAll,&sigSaved);
+	for (i=0;i<numPollThreads;i++) {
+		if (pthread_create(&pollThreadIds[i],NULL,pollWorker,NULL) != 0) {
+			EPRINTFN("mbusPoll_startThreads: pthread_create failed (%s)",strerror(errno));
+			exit(1);
 		}
-	} else {
-		EPRINTFN("unknown data type in returned data, meter %s @ %d: %s",meter->name,meter->mbusAddress);
-		meter->numErrs++;
-        return -1;
 	}
+	pthread_sigmask(SIG_SETMASK,&sigSaved,NULL);
+	VPRINTFN(2,"mbusPoll_startThreads: %d threads for %d buses",numPollThreads,numBuses);
+}
 
-	if (reply_data.data_var.record)
-		mbus_data_record_free(reply_data.data_var.record); // free's up the whole list
 
-#ifndef DISABLE_FORMULAS
-	// local formulas
-	executeMeterTypeFormulas(verboseMsg,meter);
-#endif
+void mbusPoll_stopThreads() {
+	int i;
+
+	if (!numPollThreads) return;
+	pthread_mutex_lock(&pollMutex);
+	pollTerminate++;
+	pthread_cond_broadcast(&pollStartCond);
+	pthread_mutex_unlock(&pollMutex);
+	for (i=0;i<numPollThreads;i++) pthread_join(pollThreadIds[i],NULL);
+	free(pollThreadIds);
+	pollThreadIds = NULL;
+	numPollThreads = 0;
+	pollTerminate = 0;
+}
+
 
-	if (verbose > 1) {
-		meterRegisterRead = meter->registerRead;
-		while (meterRegisterRead) {
-			if (meterRegisterRead->isInt) {
+static void printMeterRegisters(meter_t *meter) {
+	meterRegisterRead_t *meterRegisterRead;
+	char format[50];
+
+	printf("%s:\n",meter->name);
+	meterRegisterRead = meter->registerRead;
+	while (meterRegisterRead) {
+		if (meterRegisterRead->isInt) {
 #ifdef BUILD_32
-				printf(" %-20s %10lld\n",meterRegisterRead->registerDef->name,meterRegisterRead->ivalue);
+			printf(" %-20s %10lld\n",meterRegisterRead->registerDef->name,meterRegisterRead->ivalue);
 #else
-				printf(" %-20s %10d\n",meterRegisterRead->registerDef->name,(int)meterRegisterRead->fvalue);
+			printf(" %-20s %10d\n",meterRegisterRead->registerDef->name,(int)meterRegisterRead->fvalue);
 #endif
-			} else {
-				if (meterRegisterRead->registerDef->decimals == 0)
-					strcpy(format," %-20s %10.0f\n");
-				else
-					sprintf(format," %%-20s %%%d.%df\n",11+meterRegisterRead->registerDef->decimals,meterRegisterRead->registerDef->decimals);
-				printf(format,meterRegisterRead->registerDef->name,meterRegisterRead->fvalue);
-			}
-			meterRegisterRead = meterRegisterRead->next;
+		} else {
+			if (meterRegisterRead->registerDef->decimals == 0)
+				strcpy(format," %-20s %10.0f\n");
+			else
+				sprintf(format," %%-20s %%%d.%df\n",11+meterRegisterRead->registerDef->decimals,meterRegisterRead->registerDef->decimals);
+			printf(format,meterRegisterRead->registerDef->name,meterRegisterRead->fvalue);
 		}
+		meterRegisterRead = meterRegisterRead->next;
 	}
+}
 
-	clock_gettime(CLOCK_REALTIME,&timeEnd);
-	meter->queryTimeNano = ((timeEnd.tv_sec - timeStart.tv_sec) * NANO_PER_SEC) + (timeEnd.tv_nsec - timeStart.tv_nsec);
 
-	// mark complete
-	meter->meterHasBeenRead = 1;
-	return 0;
+int queryDueMeters(int verboseMsg, meter_t **due, int numDue) {
+	meter_t *meter;
+	meterBus_t *bus;
+	int numBuses = 0;
+	int numBusesDue = 0;
+	int numMeters = 0;
+	int i;
+
+	bus = meterBuses;
+	while (bus) {
+		numBuses++;
+		bus->numDue = 0;
+		bus->numMetersRead = 0;
+		bus = bus->next;
+	}
+
+	// assign the due meters to their buses, meters not connected to a bus (virtual or disabled) are queried here
+	for (i=0;i<numDue;i++) {
+		meter = due[i];
+		bus = meter->bus;
+		if (bus == NULL) {
+			if (queryMeter(verboseMsg,meter) == 0) numMeters++;
+			continue;
+		}
+		if (bus->numDue == bus->dueSize) {
+			bus->dueSize = bus->dueSize ? bus->dueSize * 2 : 16;
+			bus->due = (meter_t **)realloc(bus->due,bus->dueSize * sizeof(meter_t *));
+		}
+		if (bus->numDue == 0) numBusesDue++;
+		bus->due[bus->numDue++] = meter;
+	}
+
+	if (numBusesDue > 1 && pollThreads != 1) {
+		if (!numPollThreads) mbusPoll_startThreads(numBuses);
+		pthread_mutex_lock(&pollMutex);
+		pollVerbose = verboseMsg;
+		pollNextBus = meterBuses;
+		pollBusesPending = numBusesDue;
+		pollGeneration++;
+		pthread_cond_broadcast(&pollStartCond);
+		while (pollBusesPending) pthread_cond_wait(&pollDoneCond,&pollMutex);
+		pthread_mutex_unlock(&pollMutex);
+	} else {
+		bus = meterBuses;
+		while (bus) {
+			if (bus->numDue) queryBus(verboseMsg,bus);
+			bus = bus->next;
+		}
+	}
+
+	bus = meterBuses;
+	while (bus) {
+		numMeters += bus->numMetersRead;
+		bus = bus->next;
+	}
+
+	mbusBaud_saveCache();
+
+#ifndef DISABLE_FORMULAS
+	// meter type formulas of all meters read, once per meter type
+	executeMeterTypeFormulasBulk(verboseMsg,due,numDue);
+#endif
+
+	if (verbose > 1)
+		for (i=0;i<numDue;i++)
+			if (due[i]->meterHasBeenRead && ! due[i]->isFormulaOnly) printMeterRegisters(due[i]);
+	return numMeters;
 }
 
 
 int queryMeters(int verboseMsg) {
 	meter_t *meter;
-	int res;
+	meter_t **due;
 	int numMeters = 0;
+	int numDue = 0;
+	int numRetries;
+	int retryDelay;
+	int i;
 
 	setfvalueInfluxLast ();   // set last value for all meter registers
 	//  query
+	numDue = 0;
+	meter = meters;
+	while (meter) {
+		numDue++;
+		meter = meter->next;
+	}
+	due = (meter_t **)malloc(numDue * sizeof(meter_t *));
+	numDue = 0;
 	meter = meters;
 	while (meter) {
 		if (meter->isFormulaOnly) {
 			//numMeters++;
 			meter->meterHasBeenRead++;
 		} else {
-			res = queryMeter(verboseMsg,meter);
-			if (! meter->isTCP) msleep(500);
-			if (res != 0) {
-				EPRINTFN("%s: query failed",meter->name);
-			} else {
-				numMeters++;
-			}
+			due[numDue++] = meter;
+			meter->retriesLeft = meter->retries;
 		}
 		meter = meter->next;
 	}
+	numMeters = queryDueMeters(verboseMsg,due,numDue);
+
+	// retry failed meters, only used for the initial query and the test options so we can wait here
+	do {
+		numRetries = 0;
+		retryDelay = 0;
+		for (i=0;i<numDue;i++) {
+			meter = due[i];
+			if (! meter->meterHasBeenRead && ! meter->disabled && meter->retriesLeft > 0) {
+				meter->retriesLeft--;
+				if (meter->retryDelay > retryDelay) retryDelay = meter->retryDelay;
+				due[numRetries++] = meter;
+			}
+		}
+		numDue = numRetries;
+		if (numRetries) {
+			VPRINTFN(1,"retrying %d meter(s) in %d ms",numRetries,retryDelay);
+			msleep(retryDelay);
+			numMeters += queryDueMeters(verboseMsg,due,numDue);
+		}
+	} while (numRetries);
+	free(due);
+
 #ifndef DISABLE_FORMULAS
 	// meter formulas
-	meter = meters;
-	while (meter) {
-		if (! meter->disabled) executeMeterFormulas(verboseMsg,meter);
-		//if (res != 0) EPRINTFN("%s: execute formulas failed",meter->name);
-		meter = meter->next;
-	}
+	executeMeterFormulas(verboseMsg,NULL,0);
 #endif
     // handle influxWriteMult
     setfvalueInflux();  // set for all meters after formulas
@@ -11,25 +11,79 @@
 
 #define NANO_PER_SEC 1000000000.0
 
+extern int pollThreads;
+extern char *baudCacheFile;
+
 int mbus_ping_address(mbus_handle *handle, mbus_frame *reply, int address);
 
 int msleep(long msec);
+uint64_t getMonotonicMs();
+
+// gap between two telegrams on a serial bus, EN 13757-2 requires at least 11 bit times
+// between the response of a slave and the next request, we use 3 characters idle
+#define GAP_BITS_MIN    33
+#define GAP_MS_MIN      10		// added to the gap, USB serial adapters may add some latency
+#define GAP_MS_INIT     250		// initial gap, the gap will be reduced while a meter answers reliably
+#define GAP_MS_MAX      2000	// maximum gap after timeouts or collisions
+
+#define MBUS_TELEGRAMS_MAX 16	// maximum number of telegrams read from a multi telegram meter
 
 mbus_handle ** mbusSerial_getmh();
+mbus_handle ** mbusSerial_get (const char *device, int baud);
+const char * mbusSerial_getDeviceName (mbus_handle **mb);
+int mbusSerial_getBaud (mbus_handle **mb);
+int mbusSerial_setBaud (mbus_handle **mb, int baud);
 int mbusSerial_open (const char *device, int baud);
 void mbusSerial_close();
 
 void mbusTCP_freeAll();
 
+/**
+ * Read the baud rates meters have been switched to from baudCacheFile
+ */
+void mbusBaud_loadCache();
+
+/**
+ * Records allocated by libmbus while parsing a telegram will be taken from and
+ * returned to a per thread free list
+ */
+void mbusRecord_init();
+void mbusRecord_freePool();
+
+void mbusBus_add (meter_t *meter);
+void mbusBus_freeAll();
+void mbusPoll_stopThreads();
+void mbusBus_showStats();
+
 void setMeterFvalueInfluxLast (meter_t *meter);
 void setMeterFvalueInflux (meter_t * meter);
 
-void executeMeterFormulas(int verboseMsg, meter_t * meter);
+/**
+ * Evaluate the meter formulas of the meters that have been read, formulas are evaluated in the order of
+ * their dependencies and only if a meter or formula used has been refreshed since the last evaluation
+ * @param metersRead meters queried in this cycle, NULL for all meters
+ */
+void executeMeterFormulas(int verboseMsg, meter_t ** metersRead, int numMetersRead);
 void executeInfluxWriteCalc (int verboseMsg, meter_t *meter);
 
+/**
+ * Assign the records of a variable data telegram to the registers of the meter
+ * @param recordNumber number of the first record, will be set to the number of the next record (multi telegram)
+ * @param recordMap optional, receives the record number assigned to each record
+ * @return 0 on success, -2 if the records can not be assigned (data selection ignored)
+ */
+int process_mbus_data_variable(meter_t * meter, mbus_data_variable *data, int verboseMsg, int *recordNumber, int *recordMap);
+
 int queryMeter(int verboseMsg, meter_t *meter);
 int queryMeters(int verboseMsg);
 
+/**
+ * Query the given meters. Meters on the same bus (serial port or TCP gateway)
+ * are queried one after another, different buses are queried in parallel threads.
+ * @return the number of meters queried successful
+ */
+int queryDueMeters(int verboseMsg, meter_t **due, int numDue);
+
 
 /**
   testRTUpresent, try to find the first serial connected meter by reading either the first
@@ -42,6 +96,10 @@ meter_t * findMeter(char * name);
 void testRegCalcFormula(char * meterName);
 
 #ifndef DISABLE_FORMULAS
+/**
+ * Compile the formulas of all meters once, only the compiled formulas will be evaluated when querying meters
+ */
+void compileFormulas();
 void freeFormulaParser();
 #endif // DISABLE_FORMULAS
 
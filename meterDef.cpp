@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "meterDef.h"
 #include "argparse.h"
 #include "log.h"
@@ -19,6 +20,7 @@ extern int mqttRetain;
 extern char * mqttprefix;
 extern int influxWriteMult;    // write to influx only on x th query (>=2)
 extern int modbusDebug;
+extern int serBaudrate;
 
 
 meterType_t *meterTypes = NULL;
@@ -82,6 +84,17 @@ void freeMeters() {
 		free(m->name);
 		free(m->hostname);
 		free(m->port);
+		free(m->serDevice);
+		free(m->secondaryAddr);
+		free(m->selRecords);
+		free(m->selSeen);
+		free(m->selFound);
+		free(m->recordRegister);
+		while (m->layouts) {
+			meterLayout_t *l = m->layouts;
+			m->layouts = l->next;
+			free(l->data); free(l->mask); free(l->records); free(l);
+		}
 		free(m->influxMeasurement);
 		free(m->influxTagName);
 		free(m->mqttprefix);
@@ -99,6 +112,17 @@ typedef struct {
 } typeinfo_t;
 
 
+// baud rates supported by the M-Bus baud rate switch command
+int checkBaud(parser_t * pa, int baud) {
+	switch (baud) {
+		case 300: case 600: case 1200: case 2400: case 4800: case 9600: case 19200: case 38400:
+			return baud;
+	}
+	parserError(pa,"unsupported baud rate %d (300,600,1200,2400,4800,9600,19200 or 38400 expected)",baud);
+	return 0;
+}
+
+
 int parserExpectEqual(parser_t * pa, int tkExpected) {
 	parserExpect(pa,TK_EQUAL);
 	return parserExpect(pa,tkExpected);
@@ -190,6 +214,8 @@ int parseMeterType (parser_t * pa) {
 	meterType = (meterType_t *)calloc(1,sizeof(meterType_t));
 	meterType->mqttprefix = strdup(mqttprefix);
 	meterType->influxWriteMult = influxWriteMult;
+	meterType->retries = RETRIES_DEF;
+	meterType->retryDelay = RETRYDELAY_DEF;
 	parserExpect(pa,TK_EOL);  // after section
 
 	tk = parserGetToken(pa);
@@ -202,6 +228,16 @@ int parseMeterType (parser_t * pa) {
 				if (pa->iVal != 0)
                     if (pa->iVal < 2) parserError(pa,"influxwritemult: 0 or >=2 expected");
 				break;
+			case TK_RETRIES:
+				parserExpectEqual(pa,TK_INTVAL);
+				if (pa->iVal < 0) parserError(pa,"retries: >= 0 expected");
+				meterType->retries = pa->iVal;
+				break;
+			case TK_RETRYDELAY:
+				parserExpectEqual(pa,TK_INTVAL);
+				if (pa->iVal < 0) parserError(pa,"retrydelay: >= 0 expected");
+				meterType->retryDelay = pa->iVal;
+				break;
 			case TK_MEASUREMENT:
 				if (meterType->influxMeasurement) parserError(pa,"duplicate measurement");
 				parserExpectEqual(pa,TK_STRVAL);
@@ -418,10 +454,13 @@ int parseMeter (parser_t * pa) {
 	int enableInfluxWrite = 1;	// defaults for formula registers
     int enableMqttWrite = 1;
     int enableGrafanaWrite = 1;
+	int i;
 
 	meter = (meter_t *)calloc(1,sizeof(meter_t));
 	parserExpect(pa,TK_EOL);  // after section
 	meter->influxWriteMult = influxWriteMult;
+	meter->retries = RETRIES_DEF;
+	meter->retryDelay = RETRYDELAY_DEF;
 	meter->mbusAddress = -1;
 	meter->mbusId = -1;
 
@@ -473,6 +512,18 @@ int parseMeter (parser_t * pa) {
 				if (pa->iVal != 0)
                     if (pa->iVal < 2) parserError(pa,"influxwritemult: 0 or >=2 expected");
 				break;
+			case TK_RETRIES:
+				typeConflict++;
+				parserExpectEqual(pa,TK_INTVAL);
+				if (pa->iVal < 0) parserError(pa,"retries: >= 0 expected");
+				meter->retries = pa->iVal;
+				break;
+			case TK_RETRYDELAY:
+				typeConflict++;
+				parserExpectEqual(pa,TK_INTVAL);
+				if (pa->iVal < 0) parserError(pa,"retrydelay: >= 0 expected");
+				meter->retryDelay = pa->iVal;
+				break;
 			case TK_MQTTPREFIX:
 				//if (! typeDefined) parserError(pa,"has to be defined after type=");
 				typeConflict++;
@@ -513,6 +564,8 @@ int parseMeter (parser_t * pa) {
 				meter->mqttQOS = meter->meterType->mqttQOS;
 				meter->mqttRetain = meter->meterType->mqttRetain;
 				meter->influxWriteMult = meter->meterType->influxWriteMult;
+				meter->retries = meter->meterType->retries;
+				meter->retryDelay = meter->meterType->retryDelay;
 				if (meter->meterType->influxMeasurement) {
 					free(meter->influxMeasurement);
 					meter->influxMeasurement = strdup(meter->meterType->influxMeasurement);
@@ -546,6 +599,28 @@ int parseMeter (parser_t * pa) {
 				meter->hostname = strdup(pa->strVal);
 				meter->isTCP = 1;
 				break;
+			case TK_DEVICE:
+				if (meter->serDevice) parserError(pa,"duplicate device");
+				parserExpectEqual(pa,TK_STRVAL);
+				meter->serDevice = strdup(pa->strVal);
+				break;
+			case TK_BAUD:
+				parserExpectEqual(pa,TK_INTVAL);
+				meter->serBaud = checkBaud(pa,pa->iVal);
+				break;
+			case TK_SWITCHBAUD:
+				parserExpectEqual(pa,TK_INTVAL);
+				meter->switchBaud = checkBaud(pa,pa->iVal);
+				break;
+			case TK_GAP:
+				parserExpectEqual(pa,TK_INTVAL);
+				if (pa->iVal < 1) parserError(pa,"gap: >= 1 expected");
+				meter->gapFixed = pa->iVal;
+				break;
+			case TK_PRIORITY:
+				parserExpectEqual(pa,TK_INTVAL);
+				meter->priority = pa->iVal;
+				break;
 			case TK_MEASUREMENT:
 				typeConflict++;
 				parserExpectEqual(pa,TK_STRVAL);
@@ -556,6 +631,20 @@ int parseMeter (parser_t * pa) {
 				parserExpectEqual(pa,TK_INTVAL);
 				meter->mbusAddress = pa->iVal;
 				break;
+			case TK_SELECTIVE:
+				parserExpectEqual(pa,TK_INTVAL);
+				meter->selState = pa->iVal ? SEL_LEARN : SEL_OFF;
+				break;
+			case TK_SECONDARY:
+				parserExpectEqual(pa,TK_STRVAL);
+				if (meter->secondaryAddr) parserError(pa,"duplicate secondaryaddress");
+				if (strlen(pa->strVal) != 16) parserError(pa,"secondaryaddress: 16 hex digits expected");
+				for (i=0;i<16;i++) {
+					if (! isxdigit(pa->strVal[i])) parserError(pa,"secondaryaddress: 16 hex digits expected");
+					pa->strVal[i] = toupper(pa->strVal[i]);
+				}
+				meter->secondaryAddr = strdup(pa->strVal);
+				break;
             case TK_STRVAL:
 				meterFormula = meter->meterFormula;
 				while (meterFormula) {
@@ -679,6 +768,11 @@ int parseMeter (parser_t * pa) {
 	if (!meter->meterType)
         if (!meter->meterFormula) parserError(pa,"%s: No meter formula registers and no meter type specified, either one or both need to be specified",meter->name);
 	if (meter->mbusAddress < 0 && meter->mbusId < 0 && meter->meterType) parserError(pa,"%s: No mbus address or id specified",meter->name);
+	if (meter->isTCP && (meter->serDevice || meter->serBaud)) parserError(pa,"%s: device or baud can not be used together with hostname",meter->name);
+	if (meter->secondaryAddr) {
+		if (meter->mbusAddress != (uint64_t)-1) parserError(pa,"%s: address and secondaryaddress can not be used together",meter->name);
+		meter->mbusAddress = MBUS_ADDRESS_NETWORK_LAYER;
+	}
 
 	// add meter
 	if (meters) {
@@ -689,6 +783,7 @@ int parseMeter (parser_t * pa) {
 
 	// copy the registers to read from the meter type to the meter
 
+	meter->maxRecordNumber = -1;
 	if (meter->meterType) {		// for a virtual meter with formulas only
 		meterRegister_t *registerDef = meter->meterType->meterRegisters;
 		meterRegisterRead_t * mrrd = meter->registerRead;
@@ -701,10 +796,19 @@ int parseMeter (parser_t * pa) {
 				mrrd = mrrd->next;
 			}
 			mrrd->registerDef = registerDef;
+			if (! registerDef->isFormulaOnly && registerDef->recordNumber > meter->maxRecordNumber)
+				meter->maxRecordNumber = registerDef->recordNumber;
 			if (registerDef->decimals > 0 || registerDef->forceType == force_float)
 				mrrd->isInt = 0;
 			registerDef = registerDef->next;
 		}
+		// lookup table record number -> register, the first register wins if a record is used more than once
+		if (meter->maxRecordNumber >= 0) {
+			meter->recordRegister = (meterRegisterRead_t **)calloc(meter->maxRecordNumber+1,sizeof(meterRegisterRead_t *));
+			for (mrrd = meter->registerRead; mrrd; mrrd = mrrd->next)
+				if (! mrrd->registerDef->isFormulaOnly && mrrd->registerDef->recordNumber >= 0 && ! meter->recordRegister[mrrd->registerDef->recordNumber])
+					meter->recordRegister[mrrd->registerDef->recordNumber] = mrrd;
+		}
 	}
 	if (meter->influxWriteMult) meter->influxWriteCountdown = -1; // meter->influxWriteMult;
 
@@ -755,6 +859,8 @@ int readMeterDefinitions (const char * configFileName) {
 		"name"            ,TK_NAME,
 		"type"            ,TK_TYPE,
 		"address"         ,TK_ADDRESS,
+		"secondaryaddress",TK_SECONDARY,
+		"selective"       ,TK_SELECTIVE,
 		"hostname"        ,TK_HOSTNAME,
 		"measurement"     ,TK_MEASUREMENT,
 		"port"            ,TK_PORT,
@@ -777,6 +883,15 @@ int readMeterDefinitions (const char * configFileName) {
 		"iname"           ,TK_INAME,
 		"grafana"         ,TK_GRAFANA,
 		"gname"           ,TK_GNAME,
+		"device"          ,TK_DEVICE,
+		"baud"            ,TK_BAUD,
+		"switchbaud"      ,TK_SWITCHBAUD,
+		"retries"         ,TK_RETRIES,
+		"retrydelay"      ,TK_RETRYDELAY,
+		"gap"             ,TK_GAP,
+		"spread"          ,TK_SPREAD,
+		"overrun"         ,TK_OVERRUN,
+		"priority"        ,TK_PRIORITY,
 		NULL);
 	rc = parserBegin (pa, configFileName, 1);
 	if (rc != 0) {
@@ -810,16 +925,20 @@ int readMeterDefinitions (const char * configFileName) {
 			//meter->mb = modbus_new_tcp_pi(meter->hostname, const char *service);
 			//do the open when querying the meter to be able to retry of temporary not available
 		} else {	// modbus RTU
+			if (! meter->serBaud) meter->serBaud = serBaudrate;
+			if (meter->switchBaud == meter->serBaud) meter->switchBaud = 0;
 			if ((meter->mbusAddress > 0 || meter->mbusId > -1) && meter->disabled == 0) {
-				meter->mb = mbusSerial_getmh();
-				if (*meter->mb == NULL) {
+				meter->mb = mbusSerial_get(meter->serDevice,meter->serBaud);	// the port will be set to the baud rate of the meter before querying
+				if (meter->mb == NULL) {
 					EPRINTFN("%s: serial mbus not yet opened or no serial device specified",meter->name);
 					exit(1);
 				}
 			}
 		}
+		if (! meter->isFormulaOnly && ! meter->disabled) mbusBus_add(meter);
 		meter = meter->next;
 	}
+	mbusBaud_loadCache();
 
 	return 0;
 
@@ -4,6 +4,10 @@
 #include <mbus.h>
 #include "parser.h"
 
+#ifndef DISABLE_FORMULAS
+namespace mu { class Parser; }
+#endif
+
 #define MUPARSER_ALLOWED_CHARS "0123456789_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ."
 
 
@@ -78,6 +82,17 @@
 #define TK_SCHEDULE        626
 #define TK_INAME           627
 #define TK_GNAME           630
+#define TK_DEVICE          631
+#define TK_BAUD            632
+#define TK_RETRIES         633
+#define TK_RETRYDELAY      634
+#define TK_GAP             635
+#define TK_SPREAD          636
+#define TK_OVERRUN         637
+#define TK_PRIORITY        638
+#define TK_SECONDARY       639
+#define TK_SELECTIVE       640
+#define TK_SWITCHBAUD      641
 
 #define CHAR_TOKENS ",;()={}+-*/&%$"
 
@@ -90,6 +105,10 @@
 
 #define TARIF_MAX     4
 
+// defaults for retrying a query after a failure
+#define RETRIES_DEF       1
+#define RETRYDELAY_DEF    15000		// ms
+
 
 
 typedef enum  {force_none = 0, force_int, force_float} typeForce_t;
@@ -114,6 +133,12 @@ struct meterRegister_t {
 	int enableMqttWrite;
 	int enableGrafanaWrite;
 	influxMultProcessing_t influxMultProcessing;
+#ifndef DISABLE_FORMULAS
+	int index;					// position within the meter type
+	mu::Parser *bulkParser;		// formula compiled for the evaluation across the meters of the type
+	int *bulkInputs;			// indexes of the registers used by the formula
+	int numBulkInputs;
+#endif
 };
 
 
@@ -134,6 +159,17 @@ struct meterType_t {
 	char *mqttprefix;
 	char * influxMeasurement;
 	int influxWriteMult;
+	int retries;
+	int retryDelay;		// ms
+#ifndef DISABLE_FORMULAS
+	int numRegisters;
+	int hasFormulas;
+	int bulkSize;		// number of meters of this type, 0 if the formulas will be evaluated per meter
+	int numBulk;		// meters read in the current cycle
+	struct meterRegisterRead_t **bulkRegisters;	// registers of the meters read, numRegisters per meter
+	double *bulkValues;	// register values by register index, bulkSize values per register
+	double *bulkResults;
+#endif
 };
 
 
@@ -149,6 +185,9 @@ struct meterRegisterRead_t {
 	//int64_t ivalue;
 	int isInt;
 	int hasBeenRead;
+#ifndef DISABLE_FORMULAS
+	mu::Parser *parser;		// compiled meter type formula, bound to the registers of the meter
+#endif
 	meterRegisterRead_t *next;
 };
 
@@ -167,10 +206,61 @@ struct meterFormula_t {
     double fvalueInflux;
     double fvalueInfluxLast;
     influxMultProcessing_t influxMultProcessing;
+#ifndef DISABLE_FORMULAS
+    mu::Parser *parser;     // compiled formula, bound to the variables used by the formula
+    struct meter_t *meter;  // meter the formula belongs to
+    struct meter_t **inputMeters;       // meters with registers used by the formula
+    int numInputMeters;
+    meterFormula_t **inputFormulas;     // formulas used by the formula
+    int numInputFormulas;
+    int isVolatile;         // evaluated whenever the meter has been read (rnd or no variables used)
+    unsigned int evalSeq;   // formula cycle of the last evaluation, 0 = not yet evaluated
+    int sortState;          // used for sorting by dependencies
+#endif
     meterFormula_t *next;
 };
 
 
+typedef struct meterBus_t meterBus_t;
+
+// selective readout (SND_UD data selection)
+#define SEL_OFF    0	// full readout
+#define SEL_LEARN  1	// full readout, the record headers of the required records will be saved
+#define SEL_SEND   2	// data selection has to be sent before the next readout
+#define SEL_ACTIVE 3	// data selection has been acknowledged by the meter
+#define SEL_RESET  4	// the meter ignores the data selection, send a global readout request and use full readouts
+
+#define SEL_DRH_MAX 24
+
+typedef struct meterSelRecord_t meterSelRecord_t;
+struct meterSelRecord_t {
+	int recordNumber;
+	int drhLen;
+	unsigned char drh[SEL_DRH_MAX];	// DIF (data field cleared), DIFE, VIF, VIFE
+};
+
+// record layout of a telegram, used to decode repeated telegrams without parsing the record headers
+typedef struct meterLayoutRecord_t meterLayoutRecord_t;
+struct meterLayoutRecord_t {
+	int recordNumber;
+	int offset;					// offset of the data in the telegram
+	mbus_data_record record;	// header and data length
+};
+
+typedef struct meterLayout_t meterLayout_t;
+struct meterLayout_t {
+	int firstRecord;		// record number of the first record (multi telegram)
+	int selState;			// selective readout state the layout has been recorded with
+	int numRecords;
+	int moreRecords;
+	size_t dataSize;
+	unsigned char *data;	// telegram data the layout has been recorded from
+	unsigned char *mask;	// 1 for header bytes (ident, manufacturer, version, medium, DIF, DIFE, VIF, VIFE, LVAR)
+	meterLayoutRecord_t *records;	// records used by the meter type
+	int numUsed;
+	meterLayout_t *next;
+};
+
 typedef struct meter_t meter_t;
 struct meter_t {
     int disabled;
@@ -179,6 +269,24 @@ struct meter_t {
 	int isFormulaOnly;
 	uint64_t mbusAddress;
 	int mbusId;
+	char *secondaryAddr;	// secondary address (16 hex digits, F as wildcard), NULL for primary addressing
+	int maxRecordNumber;	// highest record number used by the meter type, -1 if none
+	meterRegisterRead_t **recordRegister;	// register by record number (maxRecordNumber+1 entries), NULL if the record is not used
+	int multiTelegram;		// set when the meter responded with more records follow
+	int selState;			// selective readout, SEL_*
+	meterSelRecord_t *selRecords;	// records used by the meter type
+	int numSelRecords;
+	meterSelRecord_t *selSeen;		// headers of all records of the readout while learning
+	int numSelSeen;
+	char *selFound;			// selected records received in the current readout
+	int selResponses;		// responses since the data selection has been sent
+	int curBaud;			// baud rate the meter currently uses, 0 for its base rate (serBaud)
+	int cachedBaud;			// baud rate the meter has last answered with, as saved to the baud cache file
+	meterLayout_t *layouts;	// record layouts of the last telegrams
+#ifndef DISABLE_FORMULAS
+	mu::Parser *localParser;	// all registers of the meter by their local name
+	unsigned int refreshSeq;	// formula cycle the meter has been read in
+#endif
 	char *name;
 	char *iname;
 	char *gname;
@@ -186,9 +294,13 @@ struct meter_t {
 	int hasSchedule;
 	int isDue;
 	mbus_handle **mb;	// pointer to a pointer to global RTU handle or a global one for a TCP connection (multiple meters may use the same IP connection)
+	meterBus_t *bus;	// serial port or TCP gateway the meter is connected to, NULL for virtual meters
 	int isTCP;
 	char *hostname;
 	char *port;
+	char *serDevice;	// serial port, NULL for the default port (--device)
+	int serBaud;		// base baud rate of the meter, 0 for the default baud rate (--baud)
+	int switchBaud;		// baud rate the meter will be switched to, 0 to keep the base rate
 	char * influxMeasurement;
 	char * influxTagName;
 	meterFormula_t * meterFormula;
@@ -207,6 +319,15 @@ struct meter_t {
 	unsigned int numInfluxWrites;
 	unsigned int numMqttWrites;
 	unsigned int numGrafanaWrites;
+	int retries;		// number of retries after a failed query
+	int retryDelay;		// ms to wait before retrying
+	int retriesLeft;	// for the current schedule
+	unsigned int retryId;	// id of the pending retry, 0 if none
+	int gapFixed;		// ms, fixed gap before a serial telegram (gap=), 0 for adaptive
+	int gap;			// ms, current gap before a serial telegram
+	int queryMsAvg;		// ms, average duration of a query including the gap, used to predict cycle times
+	int priority;		// used by the overrun policy defer of a schedule, higher values are queried first
+	int deferCount;		// number of times deferred in a row
 };
 
 
@@ -216,6 +337,31 @@ struct meterList_t {
     meterList_t *next;
 };
 
+// all meters connected via the same serial port or the same TCP gateway, meters on one bus
+// are queried one after another while different buses are queried in parallel
+struct meterBus_t {
+	char *name;				// serial device or hostname:port
+	int isTCP;
+	meterList_t *meters;
+	meter_t **due;			// meters to be queried in the current cycle
+	int numDue;
+	int dueSize;
+	int numMetersRead;		// meters successfully queried in the current cycle
+	int baud;				// serial only
+	int gapMin;				// ms, minimum gap between telegrams derived from the baud rate
+	uint64_t lastTelegram;	// ms (CLOCK_MONOTONIC), end of the last telegram
+	uint64_t statStart;		// ms (CLOCK_MONOTONIC), start of the statistics
+	uint64_t busyMs;		// time spent for telegrams since statStart
+	unsigned int numTelegrams;
+	unsigned int numTimeouts;
+	unsigned int numCollisions;
+	int64_t planMs;			// used by the scheduler to predict cycle times
+	char selected[17];		// secondary address currently selected on the bus, empty if none or unknown
+	unsigned int numSelects;
+	unsigned int numCached;	// telegrams decoded using the layout cache
+	meterBus_t *next;
+};
+
 extern meter_t *meters;
 
 int readMeterDefinitions (const char * configFileName);
@@ -0,0 +1,237 @@
+/*
+test-selective
+learning of the record headers for the selective readout (selective=1) from a full multi telegram
+readout. The records of a single telegram test frame are split into two telegrams.
+
+usage: test-selective [-v] hex-file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "log.h"
+#include "meterDef.h"
+#include "mbusread.h"
+
+// defined in emmbus2influx.cpp
+int mqttQOS;
+int mqttRetain;
+char * mqttprefix;
+int influxWriteMult;
+int modbusDebug;
+int serBaudrate = 2400;
+
+#define HEX_MAX       4096
+#define TELEGRAM1_RECORDS 13	// records in the first telegram, the remaining ones are in the second one
+
+int numOk, numFailed;
+
+
+static char * readFile(const char *fileName) {
+	FILE *f;
+	long size;
+	char *buf;
+
+	f = fopen(fileName,"r");
+	if (!f) return NULL;
+	fseek(f,0,SEEK_END);
+	size = ftell(f);
+	fseek(f,0,SEEK_SET);
+	buf = (char *)calloc(1,size+1);
+	if (fread(buf,1,size,f) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+	return buf;
+}
+
+
+// create a meter with selective readout and registers for the given record numbers (terminated by -1)
+static meter_t * createMeter(const char *name, const int *recordNumbers) {
+	meter_t *meter;
+	meterRegister_t *reg;
+	meterRegisterRead_t *rr,*rrLast = NULL;
+	char regName[32];
+	int i;
+
+	meter = (meter_t *)calloc(1,sizeof(meter_t));
+	meter->name = strdup(name);
+	meter->maxRecordNumber = -1;
+	meter->selState = SEL_LEARN;
+	for (i=0;recordNumbers[i] >= 0;i++) {
+		reg = (meterRegister_t *)calloc(1,sizeof(meterRegister_t));
+		snprintf(regName,sizeof(regName),"r%d",recordNumbers[i]);
+		reg->name = strdup(regName);
+		reg->recordNumber = recordNumbers[i];
+		rr = (meterRegisterRead_t *)calloc(1,sizeof(meterRegisterRead_t));
+		rr->registerDef = reg;
+		if (rrLast) rrLast->next = rr;
+		else meter->registerRead = rr;
+		rrLast = rr;
+		if (reg->recordNumber > meter->maxRecordNumber) meter->maxRecordNumber = reg->recordNumber;
+	}
+	meter->recordRegister = (meterRegisterRead_t **)calloc(meter->maxRecordNumber + 1,sizeof(meterRegisterRead_t *));
+	for (rr = meter->registerRead; rr; rr = rr->next)
+		meter->recordRegister[rr->registerDef->recordNumber] = rr;
+	return meter;
+}
+
+
+static void freeMeter(meter_t *meter) {
+	meterRegisterRead_t *rr,*rrNext;
+
+	rr = meter->registerRead;
+	while (rr) {
+		rrNext = rr->next;
+		free(rr->registerDef->name);
+		free(rr->registerDef);
+		free(rr);
+		rr = rrNext;
+	}
+	free(meter->recordRegister);
+	free(meter->selRecords);
+	free(meter->selSeen);
+	free(meter->selFound);
+	free(meter->name);
+	free(meter);
+}
+
+
+// split the records of a frame into two telegrams
+static int splitTelegrams(mbus_data_variable *data, mbus_data_variable *telegram1, mbus_data_variable *telegram2) {
+	mbus_data_record *record = data->record;
+	int i;
+
+	for (i=1;i<TELEGRAM1_RECORDS && record;i++) record = (mbus_data_record *)record->next;
+	if (! record || ! record->next) return -1;
+	*telegram1 = *data;
+	*telegram2 = *data;
+	telegram2->record = (mbus_data_record *)record->next;
+	record->next = NULL;
+	return 0;
+}
+
+
+// query a multi telegram meter, restart is set for the first query of a meter that has not been
+// known as a multi telegram meter, the first telegram is received twice
+static void readout(meter_t *meter, mbus_data_variable *telegram1, mbus_data_variable *telegram2, int restart) {
+	int recordNumber = 0;
+
+	if (restart) process_mbus_data_variable(meter,telegram1,0,&recordNumber,NULL);
+	recordNumber = 0;
+	process_mbus_data_variable(meter,telegram1,0,&recordNumber,NULL);
+	process_mbus_data_variable(meter,telegram2,0,&recordNumber,NULL);
+}
+
+
+static void check(const char *test, int ok) {
+	if (ok) {
+		VPRINTFN(1,"%s: ok",test);
+		numOk++;
+	} else {
+		EPRINTFN("%s: failed",test);
+		numFailed++;
+	}
+}
+
+
+static int recordNumberOf(mbus_data_variable *telegram1, mbus_data_variable *telegram2, mbus_data_record *r) {
+	mbus_data_record *record;
+	int i = 0;
+
+	for (record = telegram1->record; record; record = (mbus_data_record *)record->next, i++) if (record == r) return i;
+	for (record = telegram2->record; record; record = (mbus_data_record *)record->next, i++) if (record == r) return i;
+	return -1;
+}
+
+
+int main(int argc, char *argv[]) {
+	unsigned char data[HEX_MAX];
+	size_t len;
+	char *hex;
+	mbus_frame frame;
+	mbus_frame_data frameData;
+	mbus_data_variable telegram1,telegram2;
+	mbus_data_record *record,*dup;
+	meter_t *meter;
+	unsigned char vif;
+	int opt,i;
+	// records with headers in both telegrams
+	const int required[] = { 0, 5, TELEGRAM1_RECORDS + 6, TELEGRAM1_RECORDS + 9, -1 };
+	int requiredDup[] = { -1, -1 };
+
+	while ((opt = getopt(argc,argv,"v")) != -1) {
+		switch (opt) {
+			case 'v':
+				log_verbosity++;
+				break;
+			default:
+				fprintf(stderr,"usage: %s [-v] hex-file\n",argv[0]);
+				exit(1);
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr,"usage: %s [-v] hex-file\n",argv[0]);
+		exit(1);
+	}
+
+	mbusRecord_init();
+	hex = readFile(argv[optind]);
+	if (!hex) {
+		EPRINTFN("%s: unable to read",argv[optind]);
+		exit(1);
+	}
+	len = mbus_hex2bin(data,sizeof(data),(unsigned char *)hex,strlen(hex));
+	free(hex);
+	memset(&frame,0,sizeof(frame));
+	memset(&frameData,0,sizeof(frameData));
+	if (mbus_parse(&frame,data,len) != 0 || mbus_frame_data_parse(&frame,&frameData) != 0 || frameData.type != MBUS_DATA_TYPE_VARIABLE) {
+		EPRINTFN("%s: unable to parse as variable data telegram",argv[optind]);
+		exit(1);
+	}
+	if (splitTelegrams(&frameData.data_var,&telegram1,&telegram2) != 0) {
+		EPRINTFN("%s: less than %d records",argv[optind],TELEGRAM1_RECORDS + 1);
+		exit(1);
+	}
+
+	// a meter not yet known to use multiple telegrams, the readout is restarted after the first telegram
+	meter = createMeter("cold start",required);
+	readout(meter,&telegram1,&telegram2,1);
+	check("learn from a restarted multi telegram readout",meter->selState == SEL_LEARN && meter->numSelRecords == 4);
+	freeMeter(meter);
+
+	meter = createMeter("known multi telegram",required);
+	readout(meter,&telegram1,&telegram2,0);
+	check("learn from a multi telegram readout",meter->selState == SEL_LEARN && meter->numSelRecords == 4);
+	freeMeter(meter);
+
+	// a record that is not required has the same header as a required record in the second telegram
+	record = (mbus_data_record *)telegram1.record->next;
+	dup = telegram2.record;
+	for (i=0;i<6 && dup->next;i++) dup = (mbus_data_record *)dup->next;
+	vif = record->drh.vib.vif;
+	record->drh.vib.vif = dup->drh.vib.vif;
+	record->drh.dib.dif = (record->drh.dib.dif & 0x0F) | (dup->drh.dib.dif & 0xF0);
+	requiredDup[0] = recordNumberOf(&telegram1,&telegram2,dup);
+	meter = createMeter("same header",requiredDup);
+	readout(meter,&telegram1,&telegram2,1);
+	check("same header as a record that is not required",meter->selState == SEL_OFF);
+	freeMeter(meter);
+
+	// the other way round, the required record comes first
+	requiredDup[0] = recordNumberOf(&telegram1,&telegram2,record);
+	meter = createMeter("same header",requiredDup);
+	readout(meter,&telegram1,&telegram2,1);
+	check("same header as a later record",meter->selState == SEL_OFF);
+	freeMeter(meter);
+	record->drh.vib.vif = vif;
+
+	mbus_data_record_free(telegram1.record);
+	mbus_data_record_free(telegram2.record);
+	mbusRecord_freePool();
+
+	printf("%d tests ok, %d failed\n",numOk,numFailed);
+	return numFailed ? 1 : 0;
+}